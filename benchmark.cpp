@@ -1,8 +1,16 @@
 // This file is part of nanosort library; see nanosort.hpp for license details
 #include <cmath>
+#include <cstdlib>
 #include <string>
 #include <vector>
 
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #include "extern/hybrid_qsort.h"
 #include "extern/pdqsort.h"
 #include "nanosort.hpp"
@@ -49,8 +57,151 @@ uint32_t pcg32_random_r(pcg32_random_t *rng) {
   return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
 }
 
+// Hardware counters per sorted element; counters that aren't available are
+// negative
+struct Counters {
+  enum { kCycles, kInstructions, kBranchMisses, kL1Misses, kLLCMisses, kCount };
+
+  double values[kCount];
+
+  double ipc() const {
+    return values[kCycles] > 0 && values[kInstructions] >= 0
+               ? values[kInstructions] / values[kCycles]
+               : -1;
+  }
+};
+
+const char *kCounterNames[Counters::kCount] = {
+    "cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses"};
+
+#if defined(__linux__)
+// Counts user mode events of the calling thread using perf_event_open
+class PerfCounters {
+ public:
+  PerfCounters() {
+    static const uint64_t kL1Miss =
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    static const uint64_t kLLCMiss =
+        PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+    static const uint32_t types[Counters::kCount] = {
+        PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+        PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE};
+    static const uint64_t configs[Counters::kCount] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_BRANCH_MISSES, kL1Miss, kLLCMiss};
+
+    for (int i = 0; i < Counters::kCount; ++i) {
+      perf_event_attr attr = {};
+      attr.size = sizeof(attr);
+      attr.type = types[i];
+      attr.config = configs[i];
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format =
+          PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+      fds[i] = int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+  }
+
+  ~PerfCounters() {
+    for (int i = 0; i < Counters::kCount; ++i)
+      if (fds[i] >= 0) close(fds[i]);
+  }
+
+  bool valid() const { return fds[Counters::kCycles] >= 0; }
+
+  void start() {
+    for (int i = 0; i < Counters::kCount; ++i)
+      if (fds[i] >= 0) {
+        ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+      }
+  }
+
+  // Returns counters divided by the number of elements
+  Counters stop(double elements) {
+    Counters result;
+
+    for (int i = 0; i < Counters::kCount; ++i)
+      if (fds[i] >= 0) ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+    for (int i = 0; i < Counters::kCount; ++i) {
+      uint64_t data[3] = {};  // value, time enabled, time running
+
+      // Counters are scaled when the kernel multiplexes them
+      if (fds[i] >= 0 && read(fds[i], data, sizeof(data)) == sizeof(data) &&
+          data[2] > 0)
+        result.values[i] =
+            double(data[0]) * double(data[1]) / double(data[2]) / elements;
+      else
+        result.values[i] = -1;
+    }
+
+    return result;
+  }
+
+ private:
+  int fds[Counters::kCount];
+};
+#else
+class PerfCounters {
+ public:
+  bool valid() const { return false; }
+  void start() {}
+
+  Counters stop(double) {
+    Counters result;
+    for (int i = 0; i < Counters::kCount; ++i) result.values[i] = -1;
+    return result;
+  }
+};
+#endif
+
+// Set when counters are requested on the command line
+PerfCounters *perf = 0;
+
+void enableperf() {
+  static PerfCounters counters;
+  perf = &counters;
+
+  if (!counters.valid())
+    fprintf(stderr, "Warning: hardware counters are not available\n");
+}
+
+struct Result {
+  double nsop;
+  Counters counters;
+};
+
+// Formats result as ns/op, followed by IPC and branch misses per element when
+// counters are enabled and available
+std::string str(const Result &result) {
+  char buf[128];
+  snprintf(buf, sizeof(buf), "%.2f ns/op", result.nsop);
+
+  std::string text = buf;
+
+  if (perf && result.counters.ipc() >= 0) {
+    snprintf(buf, sizeof(buf), " %.2f ipc", result.counters.ipc());
+    text += buf;
+  }
+
+  if (perf && result.counters.values[Counters::kBranchMisses] >= 0) {
+    snprintf(buf, sizeof(buf), " %.2f bm/el",
+             result.counters.values[Counters::kBranchMisses]);
+    text += buf;
+  }
+
+  return text;
+}
+
 template <typename T, typename Sort>
-double runbench(Sort sort, const std::vector<T> &data) {
+Result runbench(Sort sort, const std::vector<T> &data) {
   double divider = data.size() * log2(double(data.size()));
 
   std::vector<T> copy(data.size());
@@ -58,37 +209,157 @@ double runbench(Sort sort, const std::vector<T> &data) {
   double time = 0;
   double start = timestamp();
 
+  Result result = {};
+
   while (timestamp() - start < kBenchRun) {
     copy = data;
 
+    if (perf) perf->start();
     double ts0 = timestamp();
-    sort(copy.begin(), copy.end());
+    sort(copy.data(), copy.data() + copy.size());
     double ts1 = timestamp();
+    Counters counters = perf ? perf->stop(double(data.size())) : Counters();
 
-    if (ts1 - ts0 < time || time == 0) time = ts1 - ts0;
+    if (ts1 - ts0 < time || time == 0) {
+      time = ts1 - ts0;
+      result.counters = counters;
+    }
   }
 
-  return time * 1e9 / divider;
+  result.nsop = time * 1e9 / divider;
+  return result;
+}
+
+struct Pair {
+  uint32_t key;
+  uint32_t value;
+
+  bool operator<(const Pair &other) const { return key < other.key; }
+};
+
+struct PairKey {
+  uint32_t operator()(const Pair &p) const { return p.key; }
+};
+
+// Radix sort is only available for arithmetic keys
+template <typename T>
+void benchradix(const std::vector<T> &) {
+  printf(" | - | -\n");
+}
+
+template <typename T, typename KeyFn>
+void benchradix(const std::vector<T> &data, KeyFn keyfn) {
+  std::vector<T> scratch(data.size());
+
+  Result t1 = runbench(
+      [&](auto beg, auto end) { nanosort_radix(beg, end, keyfn); }, data);
+  Result t2 = runbench(
+      [&](auto beg, auto end) {
+        nanosort_radix(beg, end, keyfn, scratch.data());
+      },
+      data);
+
+  printf(" | %s | %s\n", str(t1).c_str(), str(t2).c_str());
 }
 
+void benchradix(const std::vector<uint32_t> &data) {
+  benchradix(data, nanosort_detail::Identity());
+}
+
+void benchradix(const std::vector<float> &data) {
+  benchradix(data, nanosort_detail::Identity());
+}
+
+void benchradix(const std::vector<Pair> &data) { benchradix(data, PairKey()); }
+
 template <typename T>
 void bench(const std::string &name, const std::vector<T> &data) {
-  double t1 = runbench([](auto beg, auto end) { std::sort(beg, end); }, data);
-  double t2 = runbench([](auto beg, auto end) { pdqsort(beg, end); }, data);
-  double t3 = runbench(
+  Result t1 = runbench([](auto beg, auto end) { std::sort(beg, end); }, data);
+  Result t2 = runbench([](auto beg, auto end) { pdqsort(beg, end); }, data);
+  Result t3 = runbench(
       [](auto beg, auto end) { exp_gerbens::QuickSort(beg, end); }, data);
-  double t4 = runbench([](auto beg, auto end) { nanosort(beg, end); }, data);
+  Result t4 = runbench([](auto beg, auto end) { nanosort(beg, end); }, data);
+  Result t5 =
+      runbench([](auto beg, auto end) { nanosort_adaptive(beg, end); }, data);
+
+  printf("%s | %s | %s | %s | %s | %s", name.c_str(), str(t1).c_str(),
+         str(t2).c_str(), str(t3).c_str(), str(t4).c_str(), str(t5).c_str());
 
-  printf("%s | %.2f ns/op | %.2f ns/op | %.2f ns/op | %.2f ns/op\n",
-         name.c_str(), t1, t2, t3, t4);
+  benchradix(data);
 }
 
-struct Pair {
-  uint32_t key;
-  uint32_t value;
+template <typename T>
+void benchstable(const std::string &name, const std::vector<T> &data) {
+  std::vector<T> scratch(data.size());
 
-  bool operator<(const Pair &other) const { return key < other.key; }
-};
+  Result t1 = runbench(
+      [](auto beg, auto end) { std::stable_sort(beg, end); }, data);
+  Result t2 = runbench(
+      [&](auto beg, auto end) { nanosort_stable(beg, end, scratch.data()); },
+      data);
+
+  printf("%s | %s | %s\n", name.c_str(), str(t1).c_str(), str(t2).c_str());
+}
+
+// Compares sorting followed by std::unique with nanosort_unique, which drops
+// duplicates during the sort
+template <typename T>
+void benchunique(const std::string &name, const std::vector<T> &data) {
+  Result t1 = runbench(
+      [](auto beg, auto end) {
+        nanosort(beg, end);
+        std::unique(beg, end);
+      },
+      data);
+  Result t2 =
+      runbench([](auto beg, auto end) { nanosort_unique(beg, end); }, data);
+
+  printf("%s | %s | %s\n", name.c_str(), str(t1).c_str(), str(t2).c_str());
+}
+
+// Heap sort is the fallback for inputs that exceed the recursion limit
+template <typename T>
+void benchheap(const std::string &name, const std::vector<T> &data) {
+  Result t1 = runbench(
+      [](auto beg, auto end) {
+        std::make_heap(beg, end);
+        std::sort_heap(beg, end);
+      },
+      data);
+  Result t2 = runbench(
+      [](auto beg, auto end) {
+        nanosort_detail::heap_sort(beg, end, nanosort_detail::Less());
+      },
+      data);
+
+  printf("%s | %s | %s\n", name.c_str(), str(t1).c_str(), str(t2).c_str());
+}
+
+// Selection of the median, top 100 elements and 3 quantiles
+template <typename T>
+void benchselect(const std::string &name, const std::vector<T> &data) {
+  size_t n = data.size();
+  size_t ranks[] = {n / 2, n * 9 / 10, n * 99 / 100};
+
+  Result t1 = runbench(
+      [&](auto beg, auto end) { std::nth_element(beg, beg + n / 2, end); },
+      data);
+  Result t2 = runbench(
+      [&](auto beg, auto end) { nanosort_select(beg, beg + n / 2, end); },
+      data);
+  Result t3 = runbench(
+      [&](auto beg, auto end) { std::partial_sort(beg, beg + 100, end); },
+      data);
+  Result t4 = runbench(
+      [&](auto beg, auto end) { nanosort_partial(beg, beg + 100, end); }, data);
+  Result t5 = runbench(
+      [&](auto beg, auto end) { nanosort_quantiles(beg, end, ranks, 3); },
+      data);
+
+  printf("%s | %s | %s | %s | %s", name.c_str(), str(t1).c_str(),
+         str(t2).c_str(), str(t3).c_str(), str(t4).c_str());
+  printf(" | %s\n", str(t5).c_str());
+}
 
 struct PairString {
   const char *key;
@@ -99,7 +370,472 @@ struct PairString {
   }
 };
 
-int main() {
+struct PairStringKey {
+  unsigned long operator()(const PairString &p) const {
+    return strtoul(p.key, 0, 10);
+  }
+};
+
+struct Row {
+  uint32_t key;
+  uint32_t payload[31];
+};
+
+struct RowKey {
+  uint32_t operator()(const Row &r) const { return r.key; }
+};
+
+// Compares sorting by a derived key using a comparator that recomputes it,
+// using nanosort_by_key that computes it once per element, and sorting
+// indices followed by a permutation that moves every element once
+template <typename T, typename KeyFn>
+void benchkey(const std::string &name, const std::vector<T> &data,
+              KeyFn keyfn) {
+  auto comp = [&](const T &l, const T &r) { return keyfn(l) < keyfn(r); };
+
+  std::vector<uint32_t> perm(data.size());
+
+  Result t1 =
+      runbench([&](auto beg, auto end) { nanosort(beg, end, comp); }, data);
+  Result t2 = runbench(
+      [&](auto beg, auto end) { nanosort_by_key(beg, end, keyfn); }, data);
+  Result t3 = runbench(
+      [&](auto beg, auto end) {
+        nanosort_indices(beg, end, comp, perm.data());
+        nanosort_apply_permutation(beg, end, perm.data());
+      },
+      data);
+
+  printf("%s | %s | %s | %s\n", name.c_str(), str(t1).c_str(),
+         str(t2).c_str(), str(t3).c_str());
+}
+
+struct PairStringText {
+  const char *operator()(const PairString &p) const { return p.key; }
+};
+
+// Compares sorting strings with a comparator to nanosort_strings, which caches
+// string prefixes and uses multikey quicksort
+template <typename T, typename KeyFn>
+void benchstrings(const std::string &name, const std::vector<T> &data,
+                  KeyFn keyfn) {
+  Result t1 = runbench([](auto beg, auto end) { nanosort(beg, end); }, data);
+  Result t2 = runbench(
+      [&](auto beg, auto end) { nanosort_strings(beg, end, keyfn); }, data);
+
+  printf("%s | %s | %s\n", name.c_str(), str(t1).c_str(), str(t2).c_str());
+}
+
+// Merges k sorted runs of data by sorting the concatenation and by using
+// nanosort_merge_k
+template <typename T>
+void benchmerge(const std::string &name, const std::vector<T> &data,
+                size_t k) {
+  std::vector<T> runs = data;
+  std::vector<T *> first(k), last(k);
+
+  for (size_t i = 0; i < k; ++i) {
+    first[i] = runs.data() + runs.size() * i / k;
+    last[i] = runs.data() + runs.size() * (i + 1) / k;
+    nanosort(first[i], last[i]);
+  }
+
+  std::vector<T> out(data.size());
+
+  Result t1 = runbench([](auto beg, auto end) { nanosort(beg, end); }, runs);
+  Result t2 = runbench(
+      [&](auto, auto) {
+        nanosort_merge_k(first.data(), last.data(), k, out.data());
+      },
+      runs);
+
+  printf("%s | %s | %s\n", name.c_str(), str(t1).c_str(), str(t2).c_str());
+}
+
+struct Record16 {
+  uint64_t key;
+  uint64_t payload;
+
+  bool operator<(const Record16 &other) const { return key < other.key; }
+};
+
+struct Record64 {
+  uint64_t key;
+  uint64_t payload[7];
+
+  bool operator<(const Record64 &other) const { return key < other.key; }
+};
+
+// Converts rank in [0, n) to an element; conversions preserve order of ranks
+// so that all distributions have the same meaning for every type
+template <typename T>
+T fromrank(uint64_t rank, size_t n) {
+  if (sizeof(T) < 4) return T(rank * (uint64_t(1) << (sizeof(T) * 8)) / n);
+  return T(rank);
+}
+
+template <>
+Pair fromrank<Pair>(uint64_t rank, size_t) {
+  Pair result = {uint32_t(rank), uint32_t(rank * 7)};
+  return result;
+}
+
+template <>
+Record16 fromrank<Record16>(uint64_t rank, size_t) {
+  Record16 result = {rank, rank * 7};
+  return result;
+}
+
+template <>
+Record64 fromrank<Record64>(uint64_t rank, size_t) {
+  Record64 result = {rank, {rank * 7}};
+  return result;
+}
+
+template <>
+std::string fromrank<std::string>(uint64_t rank, size_t) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "key%012llu", (unsigned long long)rank);
+  return buf;
+}
+
+// McIlroy's adversary: values are assigned lazily during the sort so that the
+// pivot candidate compares low, which produces the worst case input for a
+// particular quicksort implementation
+template <typename Sort>
+void antiqsort(std::vector<uint64_t> &ranks, Sort sort) {
+  size_t n = ranks.size();
+  uint64_t gas = n - 1, solid = 0;
+  size_t candidate = 0;
+
+  std::vector<uint64_t> &val = ranks;
+  val.assign(n, gas);
+
+  std::vector<uint32_t> ptr(n);
+  for (size_t i = 0; i < n; ++i) ptr[i] = uint32_t(i);
+
+  sort(ptr.data(), ptr.data() + n, [&](uint32_t x, uint32_t y) {
+    if (val[x] == gas && val[y] == gas) {
+      if (x == candidate)
+        val[x] = solid++;
+      else
+        val[y] = solid++;
+    }
+
+    if (val[x] == gas)
+      candidate = x;
+    else if (val[y] == gas)
+      candidate = y;
+
+    return val[x] < val[y];
+  });
+}
+
+void distribution(const std::string &name, std::vector<uint64_t> &ranks,
+                  pcg32_random_t &rng) {
+  size_t n = ranks.size();
+
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t r = pcg32_random_r(&rng) % n;
+
+    if (name == "random")
+      ranks[i] = r;
+    else if (name == "sorted")
+      ranks[i] = i;
+    else if (name == "reversed")
+      ranks[i] = n - 1 - i;
+    else if (name == "fewunique")
+      ranks[i] = r % 16 * n / 16;
+    else if (name == "zipf") {
+      // Inverse of the CDF of Zipf distribution with exponent 1, ln(k)/ln(n)
+      double u = (pcg32_random_r(&rng) + 0.5) / 4294967296.0;
+      ranks[i] = uint64_t(pow(double(n), u)) - 1;
+    } else if (name == "sawtooth")
+      ranks[i] = i % (n / 16 + 1) * 16;
+    else if (name == "organpipe")
+      ranks[i] = i < n / 2 ? i * 2 : (n - 1 - i) * 2;
+  }
+}
+
+struct StdSort {
+  template <typename It, typename... Compare>
+  void operator()(It first, It last, Compare... comp) const {
+    std::sort(first, last, comp...);
+  }
+};
+
+struct PdqSort {
+  template <typename It, typename... Compare>
+  void operator()(It first, It last, Compare... comp) const {
+    pdqsort(first, last, comp...);
+  }
+};
+
+struct GerbensSort {
+  template <typename It, typename... Compare>
+  void operator()(It first, It last, Compare... comp) const {
+    exp_gerbens::QuickSort(first, last, comp...);
+  }
+};
+
+struct NanoSort {
+  template <typename It, typename... Compare>
+  void operator()(It first, It last, Compare... comp) const {
+    nanosort(first, last, comp...);
+  }
+};
+
+struct SampleSort {
+  template <typename It, typename... Compare>
+  void operator()(It first, It last, Compare... comp) const {
+    nanosort_samplesort(first, last, comp...);
+  }
+};
+
+enum Format { kFormatTable, kFormatCsv, kFormatJson };
+
+struct Matrix {
+  Format format;
+  std::vector<size_t> sizes;
+  std::vector<std::string> filters;
+  size_t rows;
+};
+
+const char *kDistributions[] = {"random",   "sorted",    "reversed",
+                                "fewunique", "zipf",      "sawtooth",
+                                "organpipe", "antiqsort"};
+
+// Returns the minimum time to sort data; small arrays are sorted in batches
+// since timer resolution is too low to time them individually
+template <typename T, typename Sort>
+Result runmatrix(Sort sort, const std::vector<T> &data) {
+  size_t n = data.size();
+  size_t copies = n < 65536 ? 65536 / n : 1;
+
+  std::vector<T> copy(n * copies);
+
+  double time = 0;
+  double start = timestamp();
+
+  Result result = {};
+
+  do {
+    for (size_t i = 0; i < copies; ++i)
+      std::copy(data.begin(), data.end(), copy.begin() + i * n);
+
+    if (perf) perf->start();
+    double ts0 = timestamp();
+    for (size_t i = 0; i < copies; ++i)
+      sort(copy.data() + i * n, copy.data() + (i + 1) * n);
+    double ts1 = timestamp();
+    Counters counters = perf ? perf->stop(double(n * copies)) : Counters();
+
+    double t = (ts1 - ts0) / double(copies);
+    if (t < time || time == 0) {
+      time = t;
+      result.counters = counters;
+    }
+  } while (timestamp() - start < kBenchRun);
+
+  result.nsop = time * 1e9 / (double(n) * log2(double(n)));
+  return result;
+}
+
+// Matches name against pattern where * matches any sequence of characters
+bool wildcard(const char *pattern, const char *name) {
+  if (*pattern == '*')
+    return wildcard(pattern + 1, name) ||
+           (*name && wildcard(pattern, name + 1));
+
+  return *pattern ? *pattern == *name && wildcard(pattern + 1, name + 1)
+                  : *name == 0;
+}
+
+bool matches(const Matrix &matrix, const std::string &name) {
+  for (size_t i = 0; i < matrix.filters.size(); ++i)
+    if (wildcard(("*" + matrix.filters[i] + "*").c_str(), name.c_str()))
+      return true;
+
+  return matrix.filters.empty();
+}
+
+// Counters that aren't available are printed using the missing string
+void printcounter(const char *format, const char *missing, double value) {
+  if (value >= 0)
+    printf(format, value);
+  else
+    printf("%s", missing);
+}
+
+void report(Matrix &matrix, const char *type, const char *dist, size_t n,
+            const char *algo, const Result &result) {
+  double nsel = result.nsop * log2(double(n));
+
+  switch (matrix.format) {
+    case kFormatTable:
+      printf("%-8s | %-9s | %9zu | %-11s | %s | %.2f ns/elem\n", type, dist,
+             n, algo, str(result).c_str(), nsel);
+      break;
+
+    case kFormatCsv:
+      printf("%s,%s,%zu,%s,%.3f,%.3f", type, dist, n, algo, result.nsop, nsel);
+
+      if (perf) {
+        printcounter(",%.3f", ",", result.counters.ipc());
+        for (int i = 0; i < Counters::kCount; ++i)
+          printcounter(",%.3f", ",", result.counters.values[i]);
+      }
+
+      printf("\n");
+      break;
+
+    case kFormatJson:
+      printf("%s  {\"type\": \"%s\", \"distribution\": \"%s\", \"size\": %zu, "
+             "\"algorithm\": \"%s\", \"ns_per_op\": %.3f, "
+             "\"ns_per_element\": %.3f",
+             matrix.rows ? ",\n" : "", type, dist, n, algo, result.nsop, nsel);
+
+      if (perf) {
+        printcounter(", \"ipc\": %.3f", ", \"ipc\": null",
+                     result.counters.ipc());
+
+        for (int i = 0; i < Counters::kCount; ++i) {
+          printf(", \"%s_per_element\": ", kCounterNames[i]);
+          printcounter("%.3f", "null", result.counters.values[i]);
+        }
+      }
+
+      printf("}");
+      break;
+  }
+
+  fflush(stdout);
+  matrix.rows++;
+}
+
+template <typename T, typename Sort>
+void benchcell(Matrix &matrix, const char *type, const char *dist,
+               const std::vector<uint64_t> &ranks, const char *algo,
+               Sort sort) {
+  size_t n = ranks.size();
+
+  std::vector<uint64_t> adversary;
+
+  // Adversarial input is specific to the algorithm
+  if (strcmp(dist, "antiqsort") == 0) {
+    adversary.resize(n);
+    antiqsort(adversary, sort);
+  }
+
+  const std::vector<uint64_t> &source = adversary.empty() ? ranks : adversary;
+
+  std::vector<T> data(n);
+  for (size_t i = 0; i < n; ++i) data[i] = fromrank<T>(source[i], n);
+
+  report(matrix, type, dist, n, algo, runmatrix(sort, data));
+}
+
+template <typename T>
+void benchtype(Matrix &matrix, const char *type) {
+  pcg32_random_t rng = {42, 0};
+
+  const char *algos[] = {"std::sort", "pdqsort", "exp_gerbens", "nanosort",
+                         "samplesort"};
+
+  for (size_t s = 0; s < matrix.sizes.size(); ++s) {
+    size_t n = matrix.sizes[s];
+
+    for (const char *dist : kDistributions) {
+      std::string prefix = std::string(type) + "/" + dist + "/" +
+                           std::to_string(n) + "/";
+
+      bool any = false;
+      for (const char *algo : algos) any |= matches(matrix, prefix + algo);
+      if (!any) continue;
+
+      std::vector<uint64_t> ranks(n);
+      distribution(dist, ranks, rng);
+
+      if (matches(matrix, prefix + algos[0]))
+        benchcell<T>(matrix, type, dist, ranks, algos[0], StdSort());
+      if (matches(matrix, prefix + algos[1]))
+        benchcell<T>(matrix, type, dist, ranks, algos[1], PdqSort());
+      if (matches(matrix, prefix + algos[2]))
+        benchcell<T>(matrix, type, dist, ranks, algos[2], GerbensSort());
+      if (matches(matrix, prefix + algos[3]))
+        benchcell<T>(matrix, type, dist, ranks, algos[3], NanoSort());
+      if (matches(matrix, prefix + algos[4]))
+        benchcell<T>(matrix, type, dist, ranks, algos[4], SampleSort());
+    }
+  }
+}
+
+// Benchmark of all sizes, element types, distributions and algorithms; each
+// cell is named type/distribution/size/algorithm, and when filters are given
+// only cells that contain one of them are measured (* matches any characters)
+int benchmatrix(int argc, char **argv) {
+  Matrix matrix = {kFormatTable, {16, 256, 4096, 65536, 1000000}, {}, 0};
+
+  for (int i = 0; i < argc; ++i) {
+    std::string arg = argv[i];
+
+    if (arg == "--csv")
+      matrix.format = kFormatCsv;
+    else if (arg == "--json")
+      matrix.format = kFormatJson;
+    else if (arg == "--perf")
+      enableperf();
+    else if (arg == "--sizes" && i + 1 < argc) {
+      matrix.sizes.clear();
+      for (char *p = argv[++i]; *p;) {
+        size_t n = strtoull(p, &p, 10);
+        if (n >= 2) matrix.sizes.push_back(n);
+        if (*p) p++;
+      }
+    } else if (arg[0] == '-') {
+      fprintf(stderr,
+              "Usage: benchmark matrix [--csv|--json] [--perf] "
+              "[--sizes 16,1000000] [filter...]\n");
+      return 1;
+    } else
+      matrix.filters.push_back(arg);
+  }
+
+  if (matrix.format == kFormatCsv) {
+    printf("type,distribution,size,algorithm,ns_per_op,ns_per_element");
+
+    if (perf) {
+      printf(",ipc");
+      for (int i = 0; i < Counters::kCount; ++i)
+        printf(",%s_per_element", kCounterNames[i]);
+    }
+
+    printf("\n");
+  }
+
+  if (matrix.format == kFormatJson) printf("[\n");
+
+  benchtype<uint8_t>(matrix, "u8");
+  benchtype<uint16_t>(matrix, "u16");
+  benchtype<uint32_t>(matrix, "u32");
+  benchtype<uint64_t>(matrix, "u64");
+  benchtype<float>(matrix, "float");
+  benchtype<double>(matrix, "double");
+  benchtype<Pair>(matrix, "pair");
+  benchtype<Record16>(matrix, "record16");
+  benchtype<Record64>(matrix, "record64");
+  benchtype<std::string>(matrix, "string");
+
+  if (matrix.format == kFormatJson) printf("\n]\n");
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "matrix") == 0)
+    return benchmatrix(argc - 2, argv + 2);
+
+  if (argc > 1 && strcmp(argv[1], "--perf") == 0) enableperf();
+
   pcg32_random_t rng = {42, 0};
   std::vector<uint32_t> test(1000000);
 
@@ -145,4 +881,59 @@ int main() {
   for (size_t i = 0; i < test.size(); ++i)
     test5[i] = "longprefixtopushtoheap" + std::to_string(pcg32_random_r(&rng));
   bench("randomstr!", test5);
+
+  printf(
+      "\nbenchmark  | std::nth_element | nanosort_select | std::partial_sort "
+      "| nanosort_partial | nanosort_quantiles\n");
+  for (size_t i = 0; i < test.size(); ++i) test[i] = pcg32_random_r(&rng);
+  benchselect("random int", test);
+  benchselect("random flt", test4);
+  benchselect("randomstr!", test5);
+
+  printf("\nbenchmark  | std::sort_heap | heap_sort\n");
+  for (size_t i = 0; i < test.size(); ++i) test[i] = pcg32_random_r(&rng);
+  benchheap("random int", test);
+  benchheap("random flt", test4);
+  benchheap("randomstr!", test5);
+
+  printf("\nbenchmark  | std::stable_sort | nanosort_stable\n");
+  for (size_t i = 0; i < test.size(); ++i) test[i] = pcg32_random_r(&rng);
+  benchstable("random int", test);
+  for (size_t i = 0; i < test.size(); ++i)
+    test[i] = pcg32_random_r(&rng) % 1000;
+  benchstable("eq1000 int", test);
+  benchstable("randompair", test2);
+  benchstable("random flt", test4);
+  benchstable("randomstr!", test5);
+
+  printf("\nbenchmark  | nanosort+unique | nanosort_unique\n");
+  for (size_t i = 0; i < test.size(); ++i) test[i] = pcg32_random_r(&rng);
+  benchunique("random int", test);
+  for (size_t i = 0; i < test.size(); ++i)
+    test[i] = pcg32_random_r(&rng) % (test.size() / 10);
+  benchunique("dup90 int ", test);
+  for (size_t i = 0; i < test.size(); ++i)
+    test[i] = pcg32_random_r(&rng) % 1000;
+  benchunique("eq1000 int", test);
+  benchunique("randomstr!", test5);
+
+  printf("\nbenchmark  | nanosort   | nanosort_merge_k\n");
+  for (size_t i = 0; i < test.size(); ++i) test[i] = pcg32_random_r(&rng);
+  benchmerge("merge2 int", test, 2);
+  benchmerge("merge4 int", test, 4);
+  benchmerge("merge16int", test, 16);
+  benchmerge("merge64int", test, 64);
+  benchmerge("merge4 str", test5, 4);
+  benchmerge("merge16str", test5, 16);
+
+  printf("\nbenchmark  | nanosort   | strings\n");
+  benchstrings("randomstrp", test3, PairStringText());
+  benchstrings("randomstr!", test5, nanosort_detail::Identity());
+
+  printf("\nbenchmark  | nanosort   | by_key     | indices\n");
+  benchkey("strp atoi ", test3, PairStringKey());
+
+  std::vector<Row> test6(test.size() / 4);
+  for (size_t i = 0; i < test6.size(); ++i) test6[i].key = pcg32_random_r(&rng);
+  benchkey("row128 int", test6, RowKey());
 }
@@ -0,0 +1,367 @@
+// This file is part of nanosort library; see nanosort.hpp for license details
+//
+// External sort for files of fixed-width binary records that don't fit in
+// memory. Records are ordered by key bytes compared as unsigned chars (same as
+// memcmp or LC_ALL=C sort); records with equal keys keep their input order.
+//
+// Usage: extsort [-m megabytes] input output record_size key_offset key_size
+//
+// Input is split into runs that fit into the memory budget; each run is sorted
+// with nanosort and appended to a temporary file. Runs are then merged with
+// large sequential reads and writes, using several passes if there are too
+// many runs to merge at once. Input and output can be - for stdin/stdout.
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "nanosort.hpp"
+
+#ifdef _WIN32
+#define fseek64 _fseeki64
+typedef long long offset_t;
+#else
+#define fseek64 fseeko
+typedef off_t offset_t;
+#endif
+
+// Runs are merged with buffers of this size per run
+const size_t kMergeBlock = 1 << 20;
+
+// Upper bound on the number of runs merged in one pass
+const size_t kMaxFanIn = 256;
+
+struct Format {
+  size_t record;
+  size_t key_offset;
+  size_t key_size;
+};
+
+struct Entry {
+  unsigned long long prefix;
+  size_t index;
+};
+
+// Orders entries by key prefix, remaining key bytes and input position
+struct EntryLess {
+  const unsigned char* data;
+  Format format;
+
+  bool operator()(const Entry& l, const Entry& r) const {
+    if (l.prefix != r.prefix) return l.prefix < r.prefix;
+
+    if (format.key_size > 8) {
+      const unsigned char* lk = data + l.index * format.record;
+      const unsigned char* rk = data + r.index * format.record;
+      size_t offset = format.key_offset + 8;
+
+      int c = memcmp(lk + offset, rk + offset, format.key_size - 8);
+      if (c) return c < 0;
+    }
+
+    return l.index < r.index;
+  }
+};
+
+struct Run {
+  offset_t begin;
+  offset_t end;
+};
+
+struct Reader {
+  offset_t offset;
+  offset_t end;
+  std::vector<unsigned char> buffer;
+  size_t pos;
+  size_t size;
+};
+
+static void fail(const char* message) {
+  fprintf(stderr, "extsort: %s\n", message);
+  exit(1);
+}
+
+static void write_data(FILE* file, const void* data, size_t size) {
+  if (fwrite(data, 1, size, file) != size) fail("write error");
+}
+
+// Reads up to size bytes, only returning less than size at the end of file
+static size_t read_data(FILE* file, void* data, size_t size) {
+  size_t result = fread(data, 1, size, file);
+  if (result != size && ferror(file)) fail("read error");
+  return result;
+}
+
+static unsigned long long load_prefix(const unsigned char* key, size_t size) {
+  unsigned long long result = 0;
+
+  // Keys are compared as big-endian numbers so that order matches memcmp
+  for (size_t i = 0; i < 8; ++i)
+    result = (result << 8) | (i < size ? key[i] : 0);
+
+  return result;
+}
+
+// Sorts records and writes them to output in sorted order
+static void sort_run(FILE* output, const unsigned char* data, size_t count,
+                     const Format& format, std::vector<Entry>& entries,
+                     std::vector<unsigned char>& block) {
+  for (size_t i = 0; i < count; ++i) {
+    entries[i].prefix =
+        load_prefix(data + i * format.record + format.key_offset,
+                    format.key_size);
+    entries[i].index = i;
+  }
+
+  EntryLess less = {data, format};
+  nanosort(entries.begin(), entries.begin() + count, less);
+
+  size_t per_block = block.size() / format.record;
+
+  for (size_t i = 0; i < count; i += per_block) {
+    size_t n = count - i < per_block ? count - i : per_block;
+
+    for (size_t j = 0; j < n; ++j)
+      memcpy(&block[j * format.record],
+             data + entries[i + j].index * format.record, format.record);
+
+    write_data(output, &block[0], n * format.record);
+  }
+}
+
+static bool refill(FILE* file, Reader& r) {
+  if (r.offset == r.end) return false;
+
+  offset_t remaining = r.end - r.offset;
+  size_t size = remaining < offset_t(r.buffer.size()) ? size_t(remaining)
+                                                       : r.buffer.size();
+
+  if (fseek64(file, r.offset, SEEK_SET) != 0) fail("seek error");
+  if (read_data(file, &r.buffer[0], size) != size)
+    fail("unexpected end of file");
+
+  r.offset += size;
+  r.pos = 0;
+  r.size = size;
+  return true;
+}
+
+// Returns true if record of reader a goes before record of reader b; readers
+// are numbered in input order so ties are resolved by reader index
+static bool before(const std::vector<Reader>& readers, size_t a, size_t b,
+                   const Format& format) {
+  const Reader& ra = readers[a];
+  const Reader& rb = readers[b];
+
+  int c = memcmp(&ra.buffer[ra.pos + format.key_offset],
+                 &rb.buffer[rb.pos + format.key_offset], format.key_size);
+
+  return c != 0 ? c < 0 : a < b;
+}
+
+static void sift_down(const std::vector<Reader>& readers,
+                      std::vector<size_t>& heap, size_t i,
+                      const Format& format) {
+  size_t n = heap.size();
+
+  for (;;) {
+    size_t best = i;
+    size_t l = 2 * i + 1, r = 2 * i + 2;
+
+    if (l < n && before(readers, heap[l], heap[best], format)) best = l;
+    if (r < n && before(readers, heap[r], heap[best], format)) best = r;
+
+    if (best == i) break;
+
+    size_t t = heap[i];
+    heap[i] = heap[best];
+    heap[best] = t;
+    i = best;
+  }
+}
+
+// Merges runs[begin, end) from input and writes the result to output
+static void merge_runs(FILE* input, const std::vector<Run>& runs,
+                       size_t begin, size_t end, FILE* output,
+                       const Format& format, size_t block_size,
+                       std::vector<unsigned char>& block) {
+  std::vector<Reader> readers(end - begin);
+  std::vector<size_t> heap;
+
+  for (size_t i = 0; i < readers.size(); ++i) {
+    Reader& r = readers[i];
+    r.offset = runs[begin + i].begin;
+    r.end = runs[begin + i].end;
+    r.buffer.resize(block_size);
+
+    if (refill(input, r)) heap.push_back(i);
+  }
+
+  for (size_t i = heap.size() / 2; i-- > 0;)
+    sift_down(readers, heap, i, format);
+
+  size_t fill = 0;
+
+  while (!heap.empty()) {
+    Reader& r = readers[heap[0]];
+
+    memcpy(&block[fill], &r.buffer[r.pos], format.record);
+    fill += format.record;
+
+    if (fill + format.record > block.size()) {
+      write_data(output, &block[0], fill);
+      fill = 0;
+    }
+
+    r.pos += format.record;
+
+    if (r.pos == r.size && !refill(input, r)) {
+      heap[0] = heap.back();
+      heap.pop_back();
+    }
+
+    if (!heap.empty()) sift_down(readers, heap, 0, format);
+  }
+
+  write_data(output, &block[0], fill);
+}
+
+static FILE* open_file(const char* path, const char* mode, FILE* stdio) {
+  if (strcmp(path, "-") == 0) {
+#ifdef _WIN32
+    _setmode(_fileno(stdio), _O_BINARY);
+#endif
+    return stdio;
+  }
+
+  FILE* file = fopen(path, mode);
+  if (!file) {
+    fprintf(stderr, "extsort: can't open %s\n", path);
+    exit(1);
+  }
+
+  return file;
+}
+
+int main(int argc, char** argv) {
+  size_t budget = size_t(256) << 20;
+
+  int arg = 1;
+  if (argc > 2 && strcmp(argv[1], "-m") == 0) {
+    budget = size_t(strtoull(argv[2], 0, 10)) << 20;
+    arg += 2;
+  }
+
+  if (argc - arg != 5 || budget == 0) {
+    fprintf(stderr,
+            "Usage: extsort [-m megabytes] input output record_size "
+            "key_offset key_size\n");
+    return 1;
+  }
+
+  Format format;
+  format.record = size_t(strtoull(argv[arg + 2], 0, 10));
+  format.key_offset = size_t(strtoull(argv[arg + 3], 0, 10));
+  format.key_size = size_t(strtoull(argv[arg + 4], 0, 10));
+
+  if (format.record == 0 || format.key_size == 0 ||
+      format.key_offset > format.record ||
+      format.key_size > format.record - format.key_offset)
+    fail("key must be a non-empty range inside the record");
+
+  // Each record in a run also needs an entry for sorting
+  size_t run_records = budget / (format.record + sizeof(Entry));
+  if (run_records == 0) fail("memory budget is smaller than one record");
+
+  size_t fan_in = budget / kMergeBlock - 1;
+  fan_in = fan_in < 2 ? 2 : fan_in > kMaxFanIn ? kMaxFanIn : fan_in;
+
+  // Each reader and the writer get one block; blocks are whole records
+  size_t block_size = budget / (fan_in + 1) / format.record * format.record;
+  block_size = block_size < format.record ? format.record : block_size;
+
+  FILE* input = open_file(argv[arg], "rb", stdin);
+
+  std::vector<unsigned char> data(run_records * format.record);
+  std::vector<Entry> entries(run_records);
+  std::vector<unsigned char> block(block_size);
+
+  std::vector<Run> runs;
+  FILE* temp = 0;
+
+  for (;;) {
+    size_t size = read_data(input, &data[0], data.size());
+    if (size % format.record) fail("input size is not a multiple of record");
+
+    // Input that fits in one run is sorted directly to output
+    if (runs.empty() && size < data.size()) {
+      FILE* output = open_file(argv[arg + 1], "wb", stdout);
+      sort_run(output, &data[0], size / format.record, format, entries,
+               block);
+      if (fclose(output) != 0) fail("write error");
+      return 0;
+    }
+
+    if (size == 0) break;
+
+    if (!temp) temp = tmpfile();
+    if (!temp) fail("can't create temporary file");
+
+    Run run;
+    run.begin = runs.empty() ? 0 : runs.back().end;
+    run.end = run.begin + offset_t(size);
+    runs.push_back(run);
+
+    sort_run(temp, &data[0], size / format.record, format, entries, block);
+
+    if (size < data.size()) break;
+  }
+
+  if (input != stdin) fclose(input);
+
+  // Release run memory before merging
+  std::vector<unsigned char>().swap(data);
+  std::vector<Entry>().swap(entries);
+
+  // Merge groups of runs into a new temporary file until one pass remains
+  while (runs.size() > fan_in) {
+    FILE* next = tmpfile();
+    if (!next) fail("can't create temporary file");
+
+    if (fflush(temp) != 0) fail("write error");
+
+    std::vector<Run> merged;
+
+    for (size_t i = 0; i < runs.size(); i += fan_in) {
+      size_t end = runs.size() - i < fan_in ? runs.size() : i + fan_in;
+
+      Run run;
+      run.begin = merged.empty() ? 0 : merged.back().end;
+      run.end = run.begin + (runs[end - 1].end - runs[i].begin);
+      merged.push_back(run);
+
+      merge_runs(temp, runs, i, end, next, format, block_size, block);
+    }
+
+    fclose(temp);
+    temp = next;
+    runs.swap(merged);
+  }
+
+  if (fflush(temp) != 0) fail("write error");
+
+  FILE* output = open_file(argv[arg + 1], "wb", stdout);
+  merge_runs(temp, runs, 0, runs.size(), output, format, block_size, block);
+  if (fclose(output) != 0) fail("write error");
+
+  fclose(temp);
+  return 0;
+}
@@ -15,13 +15,21 @@
 
 #include <assert.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 
 #ifdef _MSC_VER
 #define NANOSORT_NOINLINE __declspec(noinline)
+#define NANOSORT_FORCEINLINE __forceinline
 #define NANOSORT_UNLIKELY(c) (c)
+#define NANOSORT_PREFETCH(p) (void)(p)
+#define NANOSORT_MAY_ALIAS
 #else
 #define NANOSORT_NOINLINE __attribute__((noinline))
+#define NANOSORT_FORCEINLINE inline __attribute__((always_inline))
 #define NANOSORT_UNLIKELY(c) __builtin_expect(c, 0)
+#define NANOSORT_PREFETCH(p) __builtin_prefetch(p)
+#define NANOSORT_MAY_ALIAS __attribute__((__may_alias__))
 #endif
 
 #if __cplusplus >= 201103L
@@ -30,11 +38,69 @@
 #define NANOSORT_MOVE(v) v
 #endif
 
+// In C++20 sorting can run at compile time; code that can't be evaluated at
+// compile time, such as SIMD kernels, is skipped during constant evaluation
+#if __cplusplus >= 202002L || (defined(_MSVC_LANG) && _MSVC_LANG >= 202002L)
+#define NANOSORT_CONSTEXPR constexpr
+#define NANOSORT_CONSTANT_EVALUATED() __builtin_is_constant_evaluated()
+#else
+#define NANOSORT_CONSTEXPR
+#define NANOSORT_CONSTANT_EVALUATED() false
+#endif
+
+// SIMD kernels are selected based on the target instruction set
+#if defined(NANOSORT_NO_SIMD)
+#elif defined(__AVX512F__)
+#define NANOSORT_AVX512
+#define NANOSORT_SIMD
+#elif defined(__AVX2__)
+#define NANOSORT_AVX2
+#define NANOSORT_SIMD
+#endif
+
+#ifdef NANOSORT_SIMD
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define NANOSORT_POPCOUNT(m) __popcnt(m)
+#else
+#define NANOSORT_POPCOUNT(m) __builtin_popcount(m)
+#endif
+#endif
+
+// Statistics collected by nanosort_instrumented
+struct nanosort_stats {
+  // Number of calls to the comparison function
+  size_t comparisons;
+
+  // Number of partition steps and total size of partitioned subarrays
+  size_t partitions;
+  size_t partition_elements;
+
+  // Number of skewed partitions that separated elements equal to pivot
+  size_t skewed_partitions;
+
+  // Number of elements written to the array by partitions and small sorts,
+  // where a swap writes two elements; heap sort fallback isn't counted
+  size_t moves;
+
+  // Number of subarrays that exceeded the recursion limit and their total size
+  size_t heap_sorts;
+  size_t heap_sort_elements;
+
+  // Maximum number of nested partition steps
+  size_t max_depth;
+
+  // Number of subarrays sorted with small_sort, indexed by subarray size
+  size_t small_sorts[16];
+};
+
 namespace nanosort_detail {
 
 struct Less {
   template <typename T>
-  bool operator()(const T& l, const T& r) const {
+  NANOSORT_CONSTEXPR bool operator()(const T& l, const T& r) const {
     return l < r;
   }
 };
@@ -50,40 +116,397 @@ struct IteratorTraits<T*> {
 };
 
 template <typename T>
-void swap(T& l, T& r) {
+NANOSORT_CONSTEXPR void swap(T& l, T& r) {
   T t(NANOSORT_MOVE(l));
   l = NANOSORT_MOVE(r);
   r = NANOSORT_MOVE(t);
 }
 
+// Types with non-trivial destructors own resources that make copies and moves
+// expensive; these are sorted without copying the pivot
+template <typename T>
+struct IsTrivial {
+#if defined(__clang__)
+  enum { value = __is_trivially_destructible(T) };
+#elif defined(__GNUC__) || defined(_MSC_VER)
+  enum { value = __has_trivial_destructor(T) };
+#else
+  enum { value = true };
+#endif
+};
+
+template <bool Value>
+struct StaticAssert;
+
+template <>
+struct StaticAssert<true> {};
+
+template <typename T>
+NANOSORT_CONSTEXPR void exchange(T& a, T& b, bool c) {
+  T l = c ? b : a;
+  T h = c ? a : b;
+  a = l;
+  b = h;
+}
+
+// Compilers use branches to select floating point values, so these are
+// exchanged as integers
+template <typename U, typename T>
+void exchange_bits(T& a, T& b, bool c) {
+  U x, y;
+  memcpy(&x, &a, sizeof(T));
+  memcpy(&y, &b, sizeof(T));
+
+  U m = (x ^ y) & (0 - U(c));
+  x ^= m;
+  y ^= m;
+
+  memcpy(&a, &x, sizeof(T));
+  memcpy(&b, &y, sizeof(T));
+}
+
+inline NANOSORT_CONSTEXPR void exchange(float& a, float& b, bool c) {
+  if (NANOSORT_CONSTANT_EVALUATED())
+    exchange<float>(a, b, c);
+  else
+    exchange_bits<uint32_t>(a, b, c);
+}
+
+inline NANOSORT_CONSTEXPR void exchange(double& a, double& b, bool c) {
+  if (NANOSORT_CONSTANT_EVALUATED())
+    exchange<double>(a, b, c);
+  else
+    exchange_bits<uint64_t>(a, b, c);
+}
+
+// Compare-exchange that leaves the smaller element in a; trivial types are
+// selected without branches
+template <bool Trivial>
+struct CompareExchange {
+  template <typename T, typename Compare>
+  NANOSORT_CONSTEXPR static void run(T& a, T& b, Compare comp) {
+    if (comp(b, a)) swap(a, b);
+  }
+};
+
+template <>
+struct CompareExchange<true> {
+  template <typename T, typename Compare>
+  NANOSORT_CONSTEXPR static void run(T& a, T& b, Compare comp) {
+    exchange(a, b, comp(b, a));
+  }
+};
+
+// Sorting networks for a fixed number of elements are built at compile time as
+// lists of comparators. Wires [B, B+N) are split at the largest power of two
+// that is at most 2N/3, both parts are sorted and then combined with Batcher's
+// odd-even merge; this gives optimal networks up to 8 elements and is within 5%
+// of the best known networks up to 32 elements. Networks are built by folding
+// comparators into a state with F::Apply, which either collects them into a
+// list or runs them on a bit mask to check the network at compile time.
+struct NetworkEnd {};
+
+template <int I, int J, typename Next>
+struct Comparator {};
+
+struct NetworkList {
+  template <int I, int J, typename State>
+  struct Apply {
+    typedef Comparator<I, J, State> type;
+  };
+};
+
+template <int N, int P = 1, bool Done = (P * 2 > N)>
+struct FloorPow2 {
+  enum { value = FloorPow2<N, P * 2>::value };
+};
+
+template <int N, int P>
+struct FloorPow2<N, P, true> {
+  enum { value = P };
+};
+
+// Merge inputs are wires A0 + R*S for R < MA followed by B0 + (R-MA)*S
+template <int R, int A0, int MA, int B0, int S>
+struct MergeWire {
+  enum { value = R < MA ? A0 + R * S : B0 + (R - MA) * S };
+};
+
+// Inserts element A0 into sorted elements B0 + R*S for R < MB
+template <int A0, int B0, int MB, int S, typename F, typename State,
+          int R = 0>
+struct NetworkInsert {
+  typedef typename NetworkInsert<
+      A0, B0, MB, S, F,
+      typename F::template Apply<MergeWire<R, A0, 1, B0, S>::value,
+                                 MergeWire<R + 1, A0, 1, B0, S>::value,
+                                 State>::type,
+      R + 1>::type type;
+};
+
+template <int A0, int B0, int MB, int S, typename F, typename State>
+struct NetworkInsert<A0, B0, MB, S, F, State, MB> {
+  typedef State type;
+};
+
+// Last step of odd-even merge: odd element R is compared with even element R+1
+template <int A0, int MA, int B0, int MB, int S, typename F, typename State,
+          int R = 0, bool Last = (R == MA / 2 + (MB + 1) / 2 - 1)>
+struct NetworkMergeStep {
+  typedef typename NetworkMergeStep<
+      A0, MA, B0, MB, S, F,
+      typename F::template Apply<
+          MergeWire<R, A0 + S, MA / 2, B0 + S, S * 2>::value,
+          MergeWire<R + 1, A0, MA / 2, B0, S * 2>::value, State>::type,
+      R + 1>::type type;
+};
+
+template <int A0, int MA, int B0, int MB, int S, typename F, typename State,
+          int R>
+struct NetworkMergeStep<A0, MA, B0, MB, S, F, State, R, true> {
+  typedef State type;
+};
+
+// Merges sorted elements A0 + R*S for R < MA with sorted elements B0 + R*S for
+// R < MB; MA must be a power of two so that even and odd elements of both
+// inputs interleave after merging them separately
+template <int A0, int MA, int B0, int MB, int S, typename F, typename State,
+          int Kind = (MA == 0 || MB == 0) ? 0 : MA == 1 ? 1 : 2>
+struct NetworkMerge {
+  typedef State type;
+};
+
+template <int A0, int MA, int B0, int MB, int S, typename F, typename State>
+struct NetworkMerge<A0, MA, B0, MB, S, F, State, 1> {
+  typedef typename NetworkInsert<A0, B0, MB, S, F, State>::type type;
+};
+
+template <int A0, int MA, int B0, int MB, int S, typename F, typename State>
+struct NetworkMerge<A0, MA, B0, MB, S, F, State, 2> {
+  typedef typename NetworkMerge<A0, MA / 2, B0, (MB + 1) / 2, S * 2, F,
+                                State>::type Even;
+  typedef typename NetworkMerge<A0 + S, MA / 2, B0 + S, MB / 2, S * 2, F,
+                                Even>::type Odd;
+  typedef typename NetworkMergeStep<A0, MA, B0, MB, S, F, Odd>::type type;
+};
+
+template <int B, int N, typename F, typename State, bool Leaf = (N <= 1)>
+struct NetworkSort {
+  enum { L = FloorPow2<N * 2 / 3>::value };
+
+  typedef typename NetworkSort<B, L, F, State>::type Left;
+  typedef typename NetworkSort<B + L, N - L, F, Left>::type Right;
+  typedef typename NetworkMerge<B, L, B + L, N - L, 1, F, Right>::type type;
+};
+
+template <int B, int N, typename F, typename State>
+struct NetworkSort<B, N, F, State, true> {
+  typedef State type;
+};
+
+// Networks are checked with the 0-1 principle: a merge is correct if it merges
+// all inputs that consist of sorted sequences of zeros and ones. Merges are
+// checked by induction, so the state after merging even and odd elements is
+// computed directly and only the last step runs on each input.
+template <unsigned Bits>
+struct Mask {
+  static const unsigned value = Bits;
+};
+
+struct NetworkMask {
+  template <int I, int J, typename State>
+  struct Apply {
+    static const unsigned swap =
+        ((State::value >> I) & ~(State::value >> J) & 1) *
+        ((1u << I) | (1u << J));
+
+    typedef Mask<State::value ^ swap> type;
+  };
+};
+
+template <int N>
+struct LowBits {
+  static const unsigned value = N >= 32 ? ~0u : (1u << (N & 31)) - 1;
+};
+
+// Mask with top K of first N wires set
+template <int N, int K>
+struct TopBits {
+  static const unsigned value = LowBits<N>::value & ~LowBits<N - K>::value;
+};
+
+// Mask with top K of even or odd wires among first N wires set
+template <int N, int K, int Odd>
+struct TopParity {
+  static const unsigned value =
+      (Odd ? 0xaaaaaaaau : 0x55555555u) & LowBits<N>::value &
+      ~LowBits<2 * ((N + !Odd) / 2 - K) + Odd>::value;
+};
+
+// Merge of zeros and ones with A and B ones in the inputs
+template <int MA, int MB, int A, int B, bool Insert = (MA == 1)>
+struct MergeCheckInput {
+  enum { N = MA + MB };
+
+  // Number of ones on even wires: ones are at the end of both inputs
+  enum { E = (MA + 1) / 2 - (MA - A + 1) / 2 + (N + 1) / 2 - (N - B + 1) / 2 };
+
+  typedef Mask<TopParity<N, E, 0>::value | TopParity<N, A + B - E, 1>::value>
+      Input;
+
+  enum {
+    value = NetworkMergeStep<0, MA, MA, MB, 1, NetworkMask,
+                             Input>::type::value == TopBits<N, A + B>::value
+  };
+};
+
+template <int MA, int MB, int A, int B>
+struct MergeCheckInput<MA, MB, A, B, true> {
+  typedef Mask<TopBits<1, A>::value | (TopBits<MB, B>::value << 1)> Input;
+
+  enum {
+    value = NetworkInsert<0, 1, MB, 1, NetworkMask, Input>::type::value ==
+            TopBits<MB + 1, A + B>::value
+  };
+};
+
+template <int MA, int MB, int A = 0, int B = 0, bool Done = (A > MA)>
+struct MergeCheckInputs {
+  enum {
+    value = MergeCheckInput<MA, MB, A, B>::value &&
+            MergeCheckInputs<MA, MB, A + (B == MB), (B + 1) % (MB + 1)>::value
+  };
+};
+
+template <int MA, int MB, int A, int B>
+struct MergeCheckInputs<MA, MB, A, B, true> {
+  enum { value = true };
+};
+
+template <int MA, int MB, int Kind = (MA == 0 || MB == 0) ? 0 : MA == 1 ? 1 : 2>
+struct MergeCheck {
+  enum { value = MergeCheckInputs<MA, MB>::value };
+};
+
+template <int MA, int MB>
+struct MergeCheck<MA, MB, 0> {
+  enum { value = true };
+};
+
+template <int MA, int MB>
+struct MergeCheck<MA, MB, 2> {
+  enum {
+    value = MergeCheck<MA / 2, (MB + 1) / 2>::value &&
+            MergeCheck<MA / 2, MB / 2>::value &&
+            MergeCheckInputs<MA, MB>::value
+  };
+};
+
+template <int N, bool Leaf = (N <= 1)>
+struct NetworkCheck {
+  enum { L = FloorPow2<N * 2 / 3>::value };
+
+  enum {
+    value = NetworkCheck<L>::value && NetworkCheck<N - L>::value &&
+            MergeCheck<L, N - L>::value
+  };
+};
+
+template <int N>
+struct NetworkCheck<N, true> {
+  enum { value = true };
+};
+
+// Removes comparators that don't affect wires in Live, going from the last one
+template <typename List, unsigned Live>
+struct NetworkPrune {
+  typedef NetworkEnd type;
+};
+
+template <int I, int J, typename Next, unsigned Live,
+          bool Keep = (((Live >> I) | (Live >> J)) & 1) != 0>
+struct NetworkPruneStep {
+  typedef typename NetworkPrune<Next, Live>::type type;
+};
+
+template <int I, int J, typename Next, unsigned Live>
+struct NetworkPruneStep<I, J, Next, Live, true> {
+  typedef Comparator<
+      I, J, typename NetworkPrune<Next, Live | (1u << I) | (1u << J)>::type>
+      type;
+};
+
+template <int I, int J, typename Next, unsigned Live>
+struct NetworkPrune<Comparator<I, J, Next>, Live> {
+  typedef typename NetworkPruneStep<I, J, Next, Live>::type type;
+};
+
+// Network that sorts N elements, or only places element K if K is given
+template <int N, int K = -1>
+struct FixedNetwork {
+  enum { check = sizeof(StaticAssert<N <= 32 && NetworkCheck<N>::value>) };
+
+  typedef typename NetworkSort<0, N, NetworkList, NetworkEnd>::type Sort;
+  typedef typename NetworkPrune<Sort, K < 0 ? ~0u : 1u << (K & 31)>::type type;
+};
+
+template <typename List>
+struct NetworkRun;
+
+template <>
+struct NetworkRun<NetworkEnd> {
+  template <typename T, typename It, typename Compare>
+  NANOSORT_CONSTEXPR static void run(It, Compare) {}
+};
+
+// Comparators are stored last to first, so earlier ones run first
+template <int I, int J, typename Next>
+struct NetworkRun<Comparator<I, J, Next> > {
+  template <typename T, typename It, typename Compare>
+  NANOSORT_CONSTEXPR NANOSORT_FORCEINLINE static void run(It first,
+                                                          Compare comp) {
+    NetworkRun<Next>::template run<T>(first, comp);
+    CompareExchange<IsTrivial<T>::value>::run(first[I], first[J], comp);
+  }
+};
+
+template <int N, typename T, typename It, typename Compare>
+NANOSORT_CONSTEXPR void sort_fixed(It first, Compare comp) {
+  NetworkRun<typename FixedNetwork<N>::type>::template run<T>(first, comp);
+}
+
+// Moves median of N elements to the middle, leaving other elements unordered
+template <int N, typename T, typename It, typename Compare>
+NANOSORT_CONSTEXPR void median_fixed(It first, Compare comp) {
+  NetworkRun<typename FixedNetwork<N, N / 2>::type>::template run<T>(first,
+                                                                    comp);
+}
+
+// Compares iterators by the elements they point to
+template <typename It, typename Compare>
+struct IteratorLess {
+  Compare comp;
+
+  IteratorLess(Compare comp_) : comp(comp_) {}
+  bool operator()(It l, It r) const { return comp(*l, *r); }
+};
+
 // Return median of 5 elements in the array
 template <typename T, typename It, typename Compare>
-T median5(It first, It last, Compare comp) {
+NANOSORT_CONSTEXPR T median5(It first, It last, Compare comp) {
   size_t n = last - first;
   assert(n >= 5);
 
-  T e0 = first[(n >> 2) * 0];
-  T e1 = first[(n >> 2) * 1];
-  T e2 = first[(n >> 2) * 2];
-  T e3 = first[(n >> 2) * 3];
-  T e4 = first[n - 1];
+  T e[5] = {first[(n >> 2) * 0], first[(n >> 2) * 1], first[(n >> 2) * 2],
+            first[(n >> 2) * 3], first[n - 1]};
 
-  if (comp(e1, e0)) swap(e1, e0);
-  if (comp(e4, e3)) swap(e4, e3);
-  if (comp(e3, e0)) swap(e3, e0);
-
-  if (comp(e1, e4)) swap(e1, e4);
-  if (comp(e2, e1)) swap(e2, e1);
-  if (comp(e3, e2)) swap(e2, e3);
-
-  if (comp(e2, e1)) swap(e2, e1);
-
-  return e2;
+  median_fixed<5, T>(e, comp);
+  return e[2];
 }
 
 // Split array into x<pivot and x>=pivot
 template <typename T, typename It, typename Compare>
-It partition(T pivot, It first, It last, Compare comp) {
+NANOSORT_CONSTEXPR It partition(T pivot, It first, It last, Compare comp) {
   It res = first;
   for (It it = first; it != last; ++it) {
     bool r = comp(*it, pivot);
@@ -95,7 +518,7 @@ It partition(T pivot, It first, It last, Compare comp) {
 
 // Splits array into x<=pivot and x>pivot
 template <typename T, typename It, typename Compare>
-It partition_rev(T pivot, It first, It last, Compare comp) {
+NANOSORT_CONSTEXPR It partition_rev(T pivot, It first, It last, Compare comp) {
   It res = first;
   for (It it = first; it != last; ++it) {
     bool r = comp(pivot, *it);
@@ -105,119 +528,3712 @@ It partition_rev(T pivot, It first, It last, Compare comp) {
   return res;
 }
 
-// Push root down through the heap
-template <typename It, typename Compare>
-void heap_sift(It heap, size_t count, size_t root, Compare comp) {
-  assert(count > 0);
-  size_t last = (count - 1) >> 1;
+// Splits array into x<p1, p1<=x<=p2 and x>p2 in one pass; returns the bounds
+// of the middle part in midl/midr
+template <typename T, typename It, typename Compare>
+NANOSORT_CONSTEXPR void partition3(T p1, T p2, It first, It last, It& midl,
+                                   It& midr, Compare comp) {
+  size_t l = 0, r = 0;
+  size_t n = last - first;
 
-  while (root < last) {
-    assert(root * 2 + 2 < count);
+  for (size_t i = 0; i < n; ++i) {
+    T x = NANOSORT_MOVE(first[i]);
+    bool gt = comp(p2, x);
+    bool lt = comp(x, p1) & !gt;
 
-    size_t next = root;
-    next = comp(heap[next], heap[root * 2 + 1]) ? root * 2 + 1 : next;
-    next = comp(heap[next], heap[root * 2 + 2]) ? root * 2 + 2 : next;
+    // Elements greater than p2 are swapped with the first element of the last
+    // part, other elements rotate through the ends of the first two parts
+    size_t pl = l ^ ((l ^ r) & (0 - size_t(gt)));
 
-    if (next == root) break;
-    swap(heap[root], heap[next]);
-    root = next;
-  }
+    first[i] = NANOSORT_MOVE(first[r]);
+    first[r] = NANOSORT_MOVE(first[pl]);
+    first[pl] = NANOSORT_MOVE(x);
 
-  if (root == last && root * 2 + 1 < count &&
-      comp(heap[root], heap[root * 2 + 1])) {
-    swap(heap[root], heap[root * 2 + 1]);
+    l += lt;
+    r += !gt;
   }
+
+  midl = first + l;
+  midr = first + r;
 }
 
-// Sort array using heap sort
+// Return position of median of 5 elements in the array
 template <typename It, typename Compare>
-void heap_sort(It first, It last, Compare comp) {
-  if (first == last) return;
-
-  It heap = first;
-  size_t count = last - first;
+It median5_ref(It first, It last, Compare comp) {
+  size_t n = last - first;
+  assert(n >= 5);
 
-  for (size_t i = count / 2; i > 0; --i) {
-    heap_sift(heap, count, i - 1, comp);
-  }
+  It e[5] = {first + (n >> 2) * 0, first + (n >> 2) * 1, first + (n >> 2) * 2,
+             first + (n >> 2) * 3, first + (n - 1)};
 
-  for (size_t i = count - 1; i > 0; --i) {
-    swap(heap[0], heap[i]);
-    heap_sift(heap, i, 0, comp);
-  }
+  median_fixed<5, It>(e, IteratorLess<It, Compare>(comp));
+  return e[2];
 }
 
-template <typename T, typename It, typename Compare>
-void small_sort(It first, It last, Compare comp) {
-  size_t n = last - first;
+template <typename T, typename Compare>
+struct PivotLess {
+  const T& pivot;
+  Compare comp;
 
-  for (size_t i = n; i > 1; i -= 2) {
-    T x = NANOSORT_MOVE(first[0]);
-    T y = NANOSORT_MOVE(first[1]);
-    if (comp(y, x)) swap(y, x);
+  PivotLess(const T& pivot_, Compare comp_) : pivot(pivot_), comp(comp_) {}
+  bool operator()(const T& v) const { return comp(v, pivot); }
+};
 
-    for (size_t j = 2; j < i; j++) {
-      T z = NANOSORT_MOVE(first[j]);
+template <typename T, typename Compare>
+struct PivotLessEqual {
+  const T& pivot;
+  Compare comp;
 
-      if (comp(x, z)) swap(x, z);
-      if (comp(y, z)) swap(y, z);
-      if (comp(y, x)) swap(y, x);
+  PivotLessEqual(const T& pivot_, Compare comp_) : pivot(pivot_), comp(comp_) {}
+  bool operator()(const T& v) const { return !comp(pivot, v); }
+};
 
-      first[j - 2] = NANOSORT_MOVE(z);
-    }
+// Split array into elements that satisfy pred and the rest, only moving
+// misplaced elements; each side scans a block to collect offsets of misplaced
+// elements without branches, and the offsets are then swapped pairwise (per
+// BlockQuicksort by Edelkamp and Weiss)
+template <typename It, typename Pred, typename Stats>
+It partition_block(It first, It last, Pred pred, Stats stats) {
+  const size_t kBlock = 64;
 
-    first[i - 2] = NANOSORT_MOVE(x);
-    first[i - 1] = NANOSORT_MOVE(y);
-  }
-}
+  unsigned char offl[kBlock], offr[kBlock];
+  size_t numl = 0, numr = 0, startl = 0, startr = 0;
 
-template <typename T, typename It, typename Compare>
-void sort(It first, It last, size_t limit, Compare comp) {
-  for (;;) {
-    if (last - first < 16) {
-      small_sort<T>(first, last, comp);
-      return;
+  // [first, last) is the unprocessed range; offr are relative to last-1
+  while (size_t(last - first) >= kBlock * 2) {
+    if (numl == 0) {
+      startl = 0;
+      for (size_t i = 0; i < kBlock; ++i) {
+        offl[numl] = (unsigned char)(i);
+        numl += !pred(first[i]);
+      }
     }
 
-    if (NANOSORT_UNLIKELY(limit == 0)) {
-      heap_sort(first, last, comp);
-      return;
+    if (numr == 0) {
+      startr = 0;
+      for (size_t i = 0; i < kBlock; ++i) {
+        offr[numr] = (unsigned char)(i);
+        numr += pred(*(last - 1 - i));
+      }
     }
 
-    T pivot = median5<T>(first, last, comp);
-    It mid = partition(pivot, first, last, comp);
+    size_t num = numl < numr ? numl : numr;
 
-    // For skewed partitions compute new midpoint by separating equal elements
-    It midr = mid;
-    if (NANOSORT_UNLIKELY(mid - first <= (last - first) >> 3)) {
-      midr = partition_rev(pivot, mid, last, comp);
-    }
+    for (size_t i = 0; i < num; ++i)
+      swap(first[offl[startl + i]], *(last - 1 - offr[startr + i]));
 
-    // Per MSVC STL, this allows 1.5 log2(N) recursive steps
-    limit = (limit >> 1) + (limit >> 2);
+    stats.moved(num * 2);
 
-    if (mid - first <= last - midr) {
-      sort<T>(first, mid, limit, comp);
-      first = midr;
-    } else {
-      sort<T>(midr, last, limit, comp);
-      last = mid;
-    }
+    numl -= num, startl += num;
+    numr -= num, startr += num;
+
+    if (numl == 0) first += kBlock;
+    if (numr == 0) last -= kBlock;
+  }
+
+  // Finish the remaining elements with a regular Hoare partition
+  for (;;) {
+    while (first != last && pred(*first)) ++first;
+    while (first != last && !pred(*(last - 1))) --last;
+
+    // Comparison functions that don't use strict weak ordering can give
+    // different results for the same element, so first may be last-1 here
+    if (last - first <= 1) return first;
+
+    swap(*first, *(last - 1));
+    stats.moved(2);
+    ++first, --last;
   }
 }
 
-}  // namespace nanosort_detail
+// Order-preserving integer key that floating point elements are converted to
+// in place; elements are sorted through this type, which may alias them
+template <typename U>
+struct NANOSORT_MAY_ALIAS FloatKey {
+  typedef U Value;
 
-template <typename It, typename Compare>
-void nanosort(It first, It last, Compare comp) {
-  typedef typename nanosort_detail::IteratorTraits<It>::value_type T;
-  nanosort_detail::sort<T>(first, last, last - first, comp);
+  U value;
+
+  NANOSORT_CONSTEXPR bool operator<(const FloatKey& other) const {
+    return value < other.value;
+  }
+};
+
+template <typename U>
+NANOSORT_CONSTEXPR void exchange(FloatKey<U>& a, FloatKey<U>& b, bool c) {
+  exchange(a.value, b.value, c);
 }
 
-template <typename It>
-void nanosort(It first, It last) {
-  typedef typename nanosort_detail::IteratorTraits<It>::value_type T;
-  nanosort_detail::sort<T>(first, last, last - first, nanosort_detail::Less());
+#ifdef NANOSORT_SIMD
+template <int N>
+struct Int {};
+
+// Vector operations for primitive types; masks have one bit per lane.
+// store writes lanes with mask bits set to l and other lanes to end at r,
+// load_part/store_part access the first n lanes and pad the rest with the
+// maximum value, shuffle swaps lane i with lane i^J, min/max return a for
+// equal lanes, minmax puts the smaller value of each lane pair in a and
+// select takes lanes with mask bits from b.
+template <typename T>
+struct SimdOps;
+
+template <typename T>
+struct SimdEnabled {
+  enum { value = false };
+};
+
+#ifdef NANOSORT_AVX512
+template <typename T, int Size = sizeof(T)>
+struct SimdInt512;
+
+template <typename T>
+struct SimdInt512<T, 4> {
+  typedef __m512i Vec;
+  enum { kLanes = 16 };
+
+  static Vec load(const T* p) { return _mm512_loadu_si512(p); }
+  static Vec splat(T v) { return _mm512_set1_epi32(int(v)); }
+
+  static unsigned less(Vec x, Vec p) {
+    return T(-1) < T(0) ? _mm512_cmplt_epi32_mask(x, p)
+                        : _mm512_cmplt_epu32_mask(x, p);
+  }
+
+  static void store(T* l, T* r, Vec v, unsigned m) {
+    _mm512_mask_compressstoreu_epi32(l, __mmask16(m), v);
+    _mm512_mask_compressstoreu_epi32(r - 16 + NANOSORT_POPCOUNT(m),
+                                     __mmask16(~m), v);
+  }
+
+  static Vec load_part(const T* p, size_t n) {
+    Vec pad = _mm512_set1_epi32(T(-1) < T(0) ? 0x7fffffff : -1);
+    return _mm512_mask_loadu_epi32(pad, __mmask16((1u << n) - 1), p);
+  }
+
+  static void store_part(T* p, Vec v, size_t n) {
+    _mm512_mask_storeu_epi32(p, __mmask16((1u << n) - 1), v);
+  }
+
+  static bool unordered(Vec) { return false; }
+
+  // Network operations use masked forms with all lanes set; unmasked forms
+  // trigger false uninitialized warnings in gcc 12 headers
+  static Vec shuffle(Vec v, Int<1>) {
+    return _mm512_mask_shuffle_epi32(v, 0xffff, v, _MM_PERM_CDAB);
+  }
+
+  static Vec shuffle(Vec v, Int<2>) {
+    return _mm512_mask_shuffle_epi32(v, 0xffff, v, _MM_PERM_BADC);
+  }
+
+  static Vec shuffle(Vec v, Int<4>) {
+    return _mm512_mask_shuffle_i32x4(v, 0xffff, v, v, 0xb1);
+  }
+
+  static Vec shuffle(Vec v, Int<8>) {
+    return _mm512_mask_shuffle_i32x4(v, 0xffff, v, v, 0x4e);
+  }
+
+  static Vec min(Vec a, Vec b) {
+    return T(-1) < T(0) ? _mm512_mask_min_epi32(a, 0xffff, a, b)
+                        : _mm512_mask_min_epu32(a, 0xffff, a, b);
+  }
+
+  static Vec max(Vec a, Vec b) {
+    return T(-1) < T(0) ? _mm512_mask_max_epi32(a, 0xffff, a, b)
+                        : _mm512_mask_max_epu32(a, 0xffff, a, b);
+  }
+
+  static void minmax(Vec& a, Vec& b) {
+    Vec t = a;
+    a = min(a, b);
+    b = max(t, b);
+  }
+
+  static Vec select(Vec a, Vec b, unsigned m) {
+    return _mm512_mask_blend_epi32(__mmask16(m), a, b);
+  }
+};
+
+template <typename T>
+struct SimdInt512<T, 8> {
+  typedef __m512i Vec;
+  enum { kLanes = 8 };
+
+  static Vec load(const T* p) { return _mm512_loadu_si512(p); }
+  static Vec splat(T v) { return _mm512_set1_epi64((long long)(v)); }
+
+  static unsigned less(Vec x, Vec p) {
+    return T(-1) < T(0) ? _mm512_cmplt_epi64_mask(x, p)
+                        : _mm512_cmplt_epu64_mask(x, p);
+  }
+
+  static void store(T* l, T* r, Vec v, unsigned m) {
+    _mm512_mask_compressstoreu_epi64(l, __mmask8(m), v);
+    _mm512_mask_compressstoreu_epi64(r - 8 + NANOSORT_POPCOUNT(m),
+                                     __mmask8(~m), v);
+  }
+
+  static Vec load_part(const T* p, size_t n) {
+    Vec pad = _mm512_set1_epi64(T(-1) < T(0) ? 0x7fffffffffffffffll : -1ll);
+    return _mm512_mask_loadu_epi64(pad, __mmask8((1u << n) - 1), p);
+  }
+
+  static void store_part(T* p, Vec v, size_t n) {
+    _mm512_mask_storeu_epi64(p, __mmask8((1u << n) - 1), v);
+  }
+
+  static bool unordered(Vec) { return false; }
+
+  static Vec shuffle(Vec v, Int<1>) {
+    return _mm512_mask_shuffle_epi32(v, 0xffff, v, _MM_PERM_BADC);
+  }
+
+  static Vec shuffle(Vec v, Int<2>) {
+    return _mm512_mask_shuffle_i32x4(v, 0xffff, v, v, 0xb1);
+  }
+
+  static Vec shuffle(Vec v, Int<4>) {
+    return _mm512_mask_shuffle_i32x4(v, 0xffff, v, v, 0x4e);
+  }
+
+  static Vec min(Vec a, Vec b) {
+    return T(-1) < T(0) ? _mm512_mask_min_epi64(a, 0xff, a, b)
+                        : _mm512_mask_min_epu64(a, 0xff, a, b);
+  }
+
+  static Vec max(Vec a, Vec b) {
+    return T(-1) < T(0) ? _mm512_mask_max_epi64(a, 0xff, a, b)
+                        : _mm512_mask_max_epu64(a, 0xff, a, b);
+  }
+
+  static void minmax(Vec& a, Vec& b) {
+    Vec t = a;
+    a = min(a, b);
+    b = max(t, b);
+  }
+
+  static Vec select(Vec a, Vec b, unsigned m) {
+    return _mm512_mask_blend_epi64(__mmask8(m), a, b);
+  }
+};
+
+// Floating point minmax uses compare+blend instead of min/max instructions to
+// keep the sign of zeros intact
+template <>
+struct SimdOps<float> {
+  typedef __m512 Vec;
+  enum { kLanes = 16 };
+
+  static Vec load(const float* p) { return _mm512_loadu_ps(p); }
+  static Vec splat(float v) { return _mm512_set1_ps(v); }
+  static unsigned less(Vec x, Vec p) {
+    return _mm512_cmp_ps_mask(x, p, _CMP_LT_OQ);
+  }
+  static void store(float* l, float* r, Vec v, unsigned m) {
+    _mm512_mask_compressstoreu_ps(l, __mmask16(m), v);
+    _mm512_mask_compressstoreu_ps(r - 16 + NANOSORT_POPCOUNT(m),
+                                  __mmask16(~m), v);
+  }
+
+  static Vec load_part(const float* p, size_t n) {
+    Vec pad = _mm512_castsi512_ps(_mm512_set1_epi32(0x7f800000));
+    return _mm512_mask_loadu_ps(pad, __mmask16((1u << n) - 1), p);
+  }
+
+  static void store_part(float* p, Vec v, size_t n) {
+    _mm512_mask_storeu_ps(p, __mmask16((1u << n) - 1), v);
+  }
+
+  static bool unordered(Vec v) {
+    return _mm512_cmp_ps_mask(v, v, _CMP_UNORD_Q) != 0;
+  }
+
+  template <int J>
+  static Vec shuffle(Vec v, Int<J> j) {
+    __m512i i = _mm512_castps_si512(v);
+    return _mm512_castsi512_ps(SimdInt512<int>::shuffle(i, j));
+  }
+
+  static Vec min(Vec a, Vec b) {
+    return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(b, a, _CMP_LT_OQ), a, b);
+  }
+
+  static Vec max(Vec a, Vec b) {
+    return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(a, b, _CMP_LT_OQ), a, b);
+  }
+
+  static void minmax(Vec& a, Vec& b) {
+    __mmask16 lt = _mm512_cmp_ps_mask(b, a, _CMP_LT_OQ);
+    Vec t = a;
+    a = _mm512_mask_blend_ps(lt, a, b);
+    b = _mm512_mask_blend_ps(lt, b, t);
+  }
+
+  static Vec select(Vec a, Vec b, unsigned m) {
+    return _mm512_mask_blend_ps(__mmask16(m), a, b);
+  }
+};
+
+template <>
+struct SimdOps<double> {
+  typedef __m512d Vec;
+  enum { kLanes = 8 };
+
+  static Vec load(const double* p) { return _mm512_loadu_pd(p); }
+  static Vec splat(double v) { return _mm512_set1_pd(v); }
+  static unsigned less(Vec x, Vec p) {
+    return _mm512_cmp_pd_mask(x, p, _CMP_LT_OQ);
+  }
+  static void store(double* l, double* r, Vec v, unsigned m) {
+    _mm512_mask_compressstoreu_pd(l, __mmask8(m), v);
+    _mm512_mask_compressstoreu_pd(r - 8 + NANOSORT_POPCOUNT(m),
+                                  __mmask8(~m), v);
+  }
+
+  static Vec load_part(const double* p, size_t n) {
+    Vec pad = _mm512_castsi512_pd(_mm512_set1_epi64(0x7ff0000000000000ll));
+    return _mm512_mask_loadu_pd(pad, __mmask8((1u << n) - 1), p);
+  }
+
+  static void store_part(double* p, Vec v, size_t n) {
+    _mm512_mask_storeu_pd(p, __mmask8((1u << n) - 1), v);
+  }
+
+  static bool unordered(Vec v) {
+    return _mm512_cmp_pd_mask(v, v, _CMP_UNORD_Q) != 0;
+  }
+
+  template <int J>
+  static Vec shuffle(Vec v, Int<J> j) {
+    __m512i i = _mm512_castpd_si512(v);
+    return _mm512_castsi512_pd(SimdInt512<int64_t>::shuffle(i, j));
+  }
+
+  static Vec min(Vec a, Vec b) {
+    return _mm512_mask_blend_pd(_mm512_cmp_pd_mask(b, a, _CMP_LT_OQ), a, b);
+  }
+
+  static Vec max(Vec a, Vec b) {
+    return _mm512_mask_blend_pd(_mm512_cmp_pd_mask(a, b, _CMP_LT_OQ), a, b);
+  }
+
+  static void minmax(Vec& a, Vec& b) {
+    __mmask8 lt = _mm512_cmp_pd_mask(b, a, _CMP_LT_OQ);
+    Vec t = a;
+    a = _mm512_mask_blend_pd(lt, a, b);
+    b = _mm512_mask_blend_pd(lt, b, t);
+  }
+
+  static Vec select(Vec a, Vec b, unsigned m) {
+    return _mm512_mask_blend_pd(__mmask8(m), a, b);
+  }
+};
+
+template <typename T>
+struct SimdInt : SimdInt512<T> {};
+#else
+// Lane permutations that move lanes with mask bits set to the front and other
+// lanes to the back, packed as 4-bit lane indices
+template <int Dummy>
+struct SimdTables {
+  static const uint32_t perm32[256];
+  static const uint32_t perm64[16];
+};
+
+template <int Dummy>
+const uint32_t SimdTables<Dummy>::perm32[256] = {
+    0x76543210, 0x76543210, 0x76543201, 0x76543210, 0x76543102, 0x76543120,
+    0x76543021, 0x76543210, 0x76542103, 0x76542130, 0x76542031, 0x76542310,
+    0x76541032, 0x76541320, 0x76540321, 0x76543210, 0x76532104, 0x76532140,
+    0x76532041, 0x76532410, 0x76531042, 0x76531420, 0x76530421, 0x76534210,
+    0x76521043, 0x76521430, 0x76520431, 0x76524310, 0x76510432, 0x76514320,
+    0x76504321, 0x76543210, 0x76432105, 0x76432150, 0x76432051, 0x76432510,
+    0x76431052, 0x76431520, 0x76430521, 0x76435210, 0x76421053, 0x76421530,
+    0x76420531, 0x76425310, 0x76410532, 0x76415320, 0x76405321, 0x76453210,
+    0x76321054, 0x76321540, 0x76320541, 0x76325410, 0x76310542, 0x76315420,
+    0x76305421, 0x76354210, 0x76210543, 0x76215430, 0x76205431, 0x76254310,
+    0x76105432, 0x76154320, 0x76054321, 0x76543210, 0x75432106, 0x75432160,
+    0x75432061, 0x75432610, 0x75431062, 0x75431620, 0x75430621, 0x75436210,
+    0x75421063, 0x75421630, 0x75420631, 0x75426310, 0x75410632, 0x75416320,
+    0x75406321, 0x75463210, 0x75321064, 0x75321640, 0x75320641, 0x75326410,
+    0x75310642, 0x75316420, 0x75306421, 0x75364210, 0x75210643, 0x75216430,
+    0x75206431, 0x75264310, 0x75106432, 0x75164320, 0x75064321, 0x75643210,
+    0x74321065, 0x74321650, 0x74320651, 0x74326510, 0x74310652, 0x74316520,
+    0x74306521, 0x74365210, 0x74210653, 0x74216530, 0x74206531, 0x74265310,
+    0x74106532, 0x74165320, 0x74065321, 0x74653210, 0x73210654, 0x73216540,
+    0x73206541, 0x73265410, 0x73106542, 0x73165420, 0x73065421, 0x73654210,
+    0x72106543, 0x72165430, 0x72065431, 0x72654310, 0x71065432, 0x71654320,
+    0x70654321, 0x76543210, 0x65432107, 0x65432170, 0x65432071, 0x65432710,
+    0x65431072, 0x65431720, 0x65430721, 0x65437210, 0x65421073, 0x65421730,
+    0x65420731, 0x65427310, 0x65410732, 0x65417320, 0x65407321, 0x65473210,
+    0x65321074, 0x65321740, 0x65320741, 0x65327410, 0x65310742, 0x65317420,
+    0x65307421, 0x65374210, 0x65210743, 0x65217430, 0x65207431, 0x65274310,
+    0x65107432, 0x65174320, 0x65074321, 0x65743210, 0x64321075, 0x64321750,
+    0x64320751, 0x64327510, 0x64310752, 0x64317520, 0x64307521, 0x64375210,
+    0x64210753, 0x64217530, 0x64207531, 0x64275310, 0x64107532, 0x64175320,
+    0x64075321, 0x64753210, 0x63210754, 0x63217540, 0x63207541, 0x63275410,
+    0x63107542, 0x63175420, 0x63075421, 0x63754210, 0x62107543, 0x62175430,
+    0x62075431, 0x62754310, 0x61075432, 0x61754320, 0x60754321, 0x67543210,
+    0x54321076, 0x54321760, 0x54320761, 0x54327610, 0x54310762, 0x54317620,
+    0x54307621, 0x54376210, 0x54210763, 0x54217630, 0x54207631, 0x54276310,
+    0x54107632, 0x54176320, 0x54076321, 0x54763210, 0x53210764, 0x53217640,
+    0x53207641, 0x53276410, 0x53107642, 0x53176420, 0x53076421, 0x53764210,
+    0x52107643, 0x52176430, 0x52076431, 0x52764310, 0x51076432, 0x51764320,
+    0x50764321, 0x57643210, 0x43210765, 0x43217650, 0x43207651, 0x43276510,
+    0x43107652, 0x43176520, 0x43076521, 0x43765210, 0x42107653, 0x42176530,
+    0x42076531, 0x42765310, 0x41076532, 0x41765320, 0x40765321, 0x47653210,
+    0x32107654, 0x32176540, 0x32076541, 0x32765410, 0x31076542, 0x31765420,
+    0x30765421, 0x37654210, 0x21076543, 0x21765430, 0x20765431, 0x27654310,
+    0x10765432, 0x17654320, 0x07654321, 0x76543210,
+};
+
+template <int Dummy>
+const uint32_t SimdTables<Dummy>::perm64[16] = {
+    0x76543210, 0x76543210, 0x76541032, 0x76543210, 0x76321054, 0x76325410,
+    0x76105432, 0x76543210, 0x54321076, 0x54327610, 0x54107632, 0x54763210,
+    0x32107654, 0x32765410, 0x10765432, 0x76543210,
+};
+
+inline __m256i simd_permutation(uint32_t packed) {
+  __m256i shift = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+  __m256i index = _mm256_srlv_epi32(_mm256_set1_epi32(int(packed)), shift);
+  return _mm256_and_si256(index, _mm256_set1_epi32(7));
+}
+
+// Expands lane mask into a vector with all bits set for 32-bit lanes in mask
+inline __m256i simd_mask32(unsigned m) {
+  __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+  __m256i v = _mm256_and_si256(_mm256_set1_epi32(int(m)), bits);
+  return _mm256_cmpeq_epi32(v, bits);
+}
+
+inline __m256i simd_mask64(unsigned m) {
+  __m256i bits = _mm256_setr_epi64x(1, 2, 4, 8);
+  __m256i v = _mm256_and_si256(_mm256_set1_epi64x(m), bits);
+  return _mm256_cmpeq_epi64(v, bits);
+}
+
+template <typename T, int Size = sizeof(T)>
+struct SimdInt256;
+
+// Unsigned comparisons are performed by flipping the sign bit of both sides
+template <typename T>
+struct SimdInt256<T, 4> {
+  typedef __m256i Vec;
+  enum { kLanes = 8 };
+
+  static Vec bias() {
+    return _mm256_set1_epi32(T(-1) < T(0) ? 0 : -0x7fffffff - 1);
+  }
+
+  static Vec load(const T* p) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+  }
+
+  static Vec splat(T v) { return _mm256_set1_epi32(int(v)); }
+
+  static unsigned less(Vec x, Vec p) {
+    x = _mm256_xor_si256(x, bias());
+    p = _mm256_xor_si256(p, bias());
+    return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(p, x)));
+  }
+
+  static void store(T* l, T* r, Vec v, unsigned m) {
+    v = _mm256_permutevar8x32_epi32(v,
+                                    simd_permutation(SimdTables<0>::perm32[m]));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(l), v);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(r - 8), v);
+  }
+
+  static Vec load_part(const T* p, size_t n) {
+    Vec pad = _mm256_set1_epi32(T(-1) < T(0) ? 0x7fffffff : -1);
+    Vec mask = simd_mask32((1u << n) - 1);
+    Vec v = _mm256_maskload_epi32(reinterpret_cast<const int*>(p), mask);
+    return _mm256_blendv_epi8(pad, v, mask);
+  }
+
+  static void store_part(T* p, Vec v, size_t n) {
+    Vec mask = simd_mask32((1u << n) - 1);
+    _mm256_maskstore_epi32(reinterpret_cast<int*>(p), mask, v);
+  }
+
+  static bool unordered(Vec) { return false; }
+
+  static Vec shuffle(Vec v, Int<1>) { return _mm256_shuffle_epi32(v, 0xb1); }
+  static Vec shuffle(Vec v, Int<2>) { return _mm256_shuffle_epi32(v, 0x4e); }
+  static Vec shuffle(Vec v, Int<4>) {
+    return _mm256_permute2x128_si256(v, v, 1);
+  }
+
+  static Vec min(Vec a, Vec b) {
+    return T(-1) < T(0) ? _mm256_min_epi32(a, b) : _mm256_min_epu32(a, b);
+  }
+
+  static Vec max(Vec a, Vec b) {
+    return T(-1) < T(0) ? _mm256_max_epi32(a, b) : _mm256_max_epu32(a, b);
+  }
+
+  static void minmax(Vec& a, Vec& b) {
+    Vec t = a;
+    a = min(a, b);
+    b = max(t, b);
+  }
+
+  static Vec select(Vec a, Vec b, unsigned m) {
+    return _mm256_blendv_epi8(a, b, simd_mask32(m));
+  }
+};
+
+template <typename T>
+struct SimdInt256<T, 8> {
+  typedef __m256i Vec;
+  enum { kLanes = 4 };
+
+  static Vec bias() {
+    return _mm256_set1_epi64x(T(-1) < T(0) ? 0 : -0x7fffffffffffffffll - 1);
+  }
+
+  static Vec load(const T* p) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+  }
+
+  static Vec splat(T v) { return _mm256_set1_epi64x((long long)(v)); }
+
+  static unsigned less(Vec x, Vec p) {
+    x = _mm256_xor_si256(x, bias());
+    p = _mm256_xor_si256(p, bias());
+    return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(p, x)));
+  }
+
+  static void store(T* l, T* r, Vec v, unsigned m) {
+    v = _mm256_permutevar8x32_epi32(v,
+                                    simd_permutation(SimdTables<0>::perm64[m]));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(l), v);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(r - 4), v);
+  }
+
+  static Vec load_part(const T* p, size_t n) {
+    Vec pad = _mm256_set1_epi64x(T(-1) < T(0) ? 0x7fffffffffffffffll : -1ll);
+    Vec mask = simd_mask64((1u << n) - 1);
+    Vec v = _mm256_maskload_epi64(reinterpret_cast<const long long*>(p), mask);
+    return _mm256_blendv_epi8(pad, v, mask);
+  }
+
+  static void store_part(T* p, Vec v, size_t n) {
+    Vec mask = simd_mask64((1u << n) - 1);
+    _mm256_maskstore_epi64(reinterpret_cast<long long*>(p), mask, v);
+  }
+
+  static bool unordered(Vec) { return false; }
+
+  static Vec shuffle(Vec v, Int<1>) { return _mm256_shuffle_epi32(v, 0x4e); }
+  static Vec shuffle(Vec v, Int<2>) {
+    return _mm256_permute2x128_si256(v, v, 1);
+  }
+
+  static Vec greater(Vec a, Vec b) {
+    return _mm256_cmpgt_epi64(_mm256_xor_si256(a, bias()),
+                              _mm256_xor_si256(b, bias()));
+  }
+
+  static Vec min(Vec a, Vec b) {
+    return _mm256_blendv_epi8(a, b, greater(a, b));
+  }
+
+  static Vec max(Vec a, Vec b) {
+    return _mm256_blendv_epi8(a, b, greater(b, a));
+  }
+
+  static void minmax(Vec& a, Vec& b) {
+    Vec gt = greater(a, b);
+    Vec t = a;
+    a = _mm256_blendv_epi8(a, b, gt);
+    b = _mm256_blendv_epi8(b, t, gt);
+  }
+
+  static Vec select(Vec a, Vec b, unsigned m) {
+    return _mm256_blendv_epi8(a, b, simd_mask64(m));
+  }
+};
+
+// Floating point minmax uses compare+blend instead of min/max instructions to
+// keep the sign of zeros intact
+template <>
+struct SimdOps<float> {
+  typedef __m256 Vec;
+  enum { kLanes = 8 };
+
+  static Vec load(const float* p) { return _mm256_loadu_ps(p); }
+  static Vec splat(float v) { return _mm256_set1_ps(v); }
+  static unsigned less(Vec x, Vec p) {
+    return _mm256_movemask_ps(_mm256_cmp_ps(x, p, _CMP_LT_OQ));
+  }
+  static void store(float* l, float* r, Vec v, unsigned m) {
+    v = _mm256_permutevar8x32_ps(v, simd_permutation(SimdTables<0>::perm32[m]));
+    _mm256_storeu_ps(l, v);
+    _mm256_storeu_ps(r - 8, v);
+  }
+
+  static Vec load_part(const float* p, size_t n) {
+    Vec pad = _mm256_castsi256_ps(_mm256_set1_epi32(0x7f800000));
+    __m256i mask = simd_mask32((1u << n) - 1);
+    return _mm256_blendv_ps(pad, _mm256_maskload_ps(p, mask),
+                            _mm256_castsi256_ps(mask));
+  }
+
+  static void store_part(float* p, Vec v, size_t n) {
+    _mm256_maskstore_ps(p, simd_mask32((1u << n) - 1), v);
+  }
+
+  static bool unordered(Vec v) {
+    return _mm256_movemask_ps(_mm256_cmp_ps(v, v, _CMP_UNORD_Q)) != 0;
+  }
+
+  static Vec shuffle(Vec v, Int<1>) { return _mm256_permute_ps(v, 0xb1); }
+  static Vec shuffle(Vec v, Int<2>) { return _mm256_permute_ps(v, 0x4e); }
+  static Vec shuffle(Vec v, Int<4>) { return _mm256_permute2f128_ps(v, v, 1); }
+
+  static Vec min(Vec a, Vec b) {
+    return _mm256_blendv_ps(a, b, _mm256_cmp_ps(b, a, _CMP_LT_OQ));
+  }
+
+  static Vec max(Vec a, Vec b) {
+    return _mm256_blendv_ps(a, b, _mm256_cmp_ps(a, b, _CMP_LT_OQ));
+  }
+
+  static void minmax(Vec& a, Vec& b) {
+    Vec lt = _mm256_cmp_ps(b, a, _CMP_LT_OQ);
+    Vec t = a;
+    a = _mm256_blendv_ps(a, b, lt);
+    b = _mm256_blendv_ps(b, t, lt);
+  }
+
+  static Vec select(Vec a, Vec b, unsigned m) {
+    return _mm256_blendv_ps(a, b, _mm256_castsi256_ps(simd_mask32(m)));
+  }
+};
+
+template <>
+struct SimdOps<double> {
+  typedef __m256d Vec;
+  enum { kLanes = 4 };
+
+  static Vec load(const double* p) { return _mm256_loadu_pd(p); }
+  static Vec splat(double v) { return _mm256_set1_pd(v); }
+  static unsigned less(Vec x, Vec p) {
+    return _mm256_movemask_pd(_mm256_cmp_pd(x, p, _CMP_LT_OQ));
+  }
+  static void store(double* l, double* r, Vec v, unsigned m) {
+    __m256i perm = simd_permutation(SimdTables<0>::perm64[m]);
+    v = _mm256_castps_pd(_mm256_permutevar8x32_ps(_mm256_castpd_ps(v), perm));
+    _mm256_storeu_pd(l, v);
+    _mm256_storeu_pd(r - 4, v);
+  }
+
+  static Vec load_part(const double* p, size_t n) {
+    Vec pad = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7ff0000000000000ll));
+    __m256i mask = simd_mask64((1u << n) - 1);
+    return _mm256_blendv_pd(pad, _mm256_maskload_pd(p, mask),
+                            _mm256_castsi256_pd(mask));
+  }
+
+  static void store_part(double* p, Vec v, size_t n) {
+    _mm256_maskstore_pd(p, simd_mask64((1u << n) - 1), v);
+  }
+
+  static bool unordered(Vec v) {
+    return _mm256_movemask_pd(_mm256_cmp_pd(v, v, _CMP_UNORD_Q)) != 0;
+  }
+
+  static Vec shuffle(Vec v, Int<1>) { return _mm256_permute_pd(v, 5); }
+  static Vec shuffle(Vec v, Int<2>) { return _mm256_permute2f128_pd(v, v, 1); }
+
+  static Vec min(Vec a, Vec b) {
+    return _mm256_blendv_pd(a, b, _mm256_cmp_pd(b, a, _CMP_LT_OQ));
+  }
+
+  static Vec max(Vec a, Vec b) {
+    return _mm256_blendv_pd(a, b, _mm256_cmp_pd(a, b, _CMP_LT_OQ));
+  }
+
+  static void minmax(Vec& a, Vec& b) {
+    Vec lt = _mm256_cmp_pd(b, a, _CMP_LT_OQ);
+    Vec t = a;
+    a = _mm256_blendv_pd(a, b, lt);
+    b = _mm256_blendv_pd(b, t, lt);
+  }
+
+  static Vec select(Vec a, Vec b, unsigned m) {
+    return _mm256_blendv_pd(a, b, _mm256_castsi256_pd(simd_mask64(m)));
+  }
+};
+
+template <typename T>
+struct SimdInt : SimdInt256<T> {};
+#endif
+
+// Keys of floating point elements are accessed as integers by the vector
+// loads and stores, which may alias anything
+template <typename T>
+struct SimdKeyOps : SimdInt<typename T::Value> {
+  typedef typename T::Value U;
+  typedef SimdInt<U> Base;
+  typedef typename Base::Vec Vec;
+
+  static Vec load(const T* p) {
+    return Base::load(reinterpret_cast<const U*>(p));
+  }
+
+  static Vec splat(T v) { return Base::splat(v.value); }
+
+  static void store(T* l, T* r, Vec v, unsigned m) {
+    Base::store(reinterpret_cast<U*>(l), reinterpret_cast<U*>(r), v, m);
+  }
+
+  static Vec load_part(const T* p, size_t n) {
+    return Base::load_part(reinterpret_cast<const U*>(p), n);
+  }
+
+  static void store_part(T* p, Vec v, size_t n) {
+    Base::store_part(reinterpret_cast<U*>(p), v, n);
+  }
+};
+
+#define NANOSORT_SIMD_INT(T) \
+  template <>                \
+  struct SimdOps<T> : SimdInt<T> {};
+
+#define NANOSORT_SIMD_KEY(T) \
+  template <>                \
+  struct SimdOps<T> : SimdKeyOps<T> {};
+
+#define NANOSORT_SIMD_ENABLE(T) \
+  template <>                   \
+  struct SimdEnabled<T> {       \
+    enum { value = true };      \
+  };
+
+NANOSORT_SIMD_INT(int)
+NANOSORT_SIMD_INT(unsigned int)
+NANOSORT_SIMD_INT(long)
+NANOSORT_SIMD_INT(unsigned long)
+NANOSORT_SIMD_ENABLE(int)
+NANOSORT_SIMD_ENABLE(unsigned int)
+NANOSORT_SIMD_ENABLE(long)
+NANOSORT_SIMD_ENABLE(unsigned long)
+#if __cplusplus >= 201103L || defined(_MSC_VER)
+NANOSORT_SIMD_INT(long long)
+NANOSORT_SIMD_INT(unsigned long long)
+NANOSORT_SIMD_ENABLE(long long)
+NANOSORT_SIMD_ENABLE(unsigned long long)
+#endif
+NANOSORT_SIMD_ENABLE(float)
+NANOSORT_SIMD_ENABLE(double)
+NANOSORT_SIMD_KEY(FloatKey<uint32_t>)
+NANOSORT_SIMD_KEY(FloatKey<uint64_t>)
+NANOSORT_SIMD_ENABLE(FloatKey<uint32_t>)
+NANOSORT_SIMD_ENABLE(FloatKey<uint64_t>)
+
+#undef NANOSORT_SIMD_INT
+#undef NANOSORT_SIMD_KEY
+#undef NANOSORT_SIMD_ENABLE
+
+// Bitonic sorting network for 16 elements held in 16/kLanes registers; each
+// compare-exchange step is expanded at compile time. Element I takes the
+// larger value of the pair (I, I^J) if it is the upper element of an
+// ascending block of size K or the lower element of a descending one.
+template <int I, int J, int K>
+struct BitonicMax {
+  enum { value = ((I & J) != 0) != ((I & K) != 0) };
+};
+
+template <int Base, int J, int K, int Lanes>
+struct BitonicMask {
+  enum {
+    value = (BitonicMax<Base + Lanes - 1, J, K>::value << (Lanes - 1)) |
+            BitonicMask<Base, J, K, Lanes - 1>::value
+  };
+};
+
+template <int Base, int J, int K>
+struct BitonicMask<Base, J, K, 0> {
+  enum { value = 0 };
+};
+
+template <typename Ops, int J, int K, int R,
+          bool Cross = (J >= int(Ops::kLanes)),
+          bool Last = (R * int(Ops::kLanes) == 16)>
+struct BitonicStep;
+
+template <typename Ops, int J, int K, int R, bool Cross>
+struct BitonicStep<Ops, J, K, R, Cross, true> {
+  static void run(typename Ops::Vec*) {}
+};
+
+// Pairs within one register: compare with shuffled register and pick lanes
+template <typename Ops, int J, int K, int R>
+struct BitonicStep<Ops, J, K, R, false, false> {
+  static void run(typename Ops::Vec* v) {
+    typename Ops::Vec s = Ops::shuffle(v[R], Int<J>());
+    v[R] = Ops::select(Ops::min(v[R], s), Ops::max(v[R], s),
+                       BitonicMask<R * Ops::kLanes, J, K, Ops::kLanes>::value);
+
+    BitonicStep<Ops, J, K, R + 1>::run(v);
+  }
+};
+
+// Pairs in two registers: compare lanes of both registers directly
+template <typename Ops, int J, int K, int R>
+struct BitonicStep<Ops, J, K, R, true, false> {
+  static void run(typename Ops::Vec* v) {
+    const int P = R ^ (J / Ops::kLanes);
+
+    if (P > R) {
+      if ((R * Ops::kLanes) & K)
+        Ops::minmax(v[P], v[R]);
+      else
+        Ops::minmax(v[R], v[P]);
+    }
+
+    BitonicStep<Ops, J, K, R + 1>::run(v);
+  }
+};
+
+template <typename Ops, int J, int K>
+struct BitonicSort {
+  static void run(typename Ops::Vec* v) {
+    BitonicStep<Ops, J, K, 0>::run(v);
+    BitonicSort<Ops, J == 1 ? K : J / 2, J == 1 ? K * 2 : K>::run(v);
+  }
+};
+
+template <typename Ops, int J>
+struct BitonicSort<Ops, J, 32> {
+  static void run(typename Ops::Vec*) {}
+};
+
+// Sort up to 16 elements by padding them with maximum values
+template <typename T>
+bool small_sort_simd(T* first, T* last) {
+  typedef SimdOps<T> Ops;
+  const size_t kLanes = Ops::kLanes;
+  const size_t kRegs = 16 / kLanes;
+
+  size_t n = last - first;
+  assert(n <= 16);
+
+  typename Ops::Vec v[kRegs];
+  bool unordered = false;
+
+  for (size_t i = 0; i < kRegs; ++i) {
+    size_t count = n > i * kLanes ? n - i * kLanes : 0;
+    count = count > kLanes ? kLanes : count;
+
+    v[i] = Ops::load_part(first + (count ? i * kLanes : 0), count);
+    unordered |= Ops::unordered(v[i]);
+  }
+
+  // NaN values break the network assumptions; padding could end up in the
+  // middle of the array
+  if (unordered) return false;
+
+  BitonicSort<Ops, 1, 2>::run(v);
+
+  for (size_t i = 0; i < kRegs; ++i) {
+    size_t count = n > i * kLanes ? n - i * kLanes : 0;
+    count = count > kLanes ? kLanes : count;
+
+    Ops::store_part(first + (count ? i * kLanes : 0), v[i], count);
+  }
+
+  return true;
+}
+
+// Vectorized version of partition/partition_rev; elements are read from both
+// ends of the array in blocks of several vectors, always from the side that has
+// less free space, and each vector is split into left and right lanes that are
+// written to both ends.
+template <bool Rev, typename T>
+T* partition_simd(T pivot, T* first, T* last) {
+  typedef SimdOps<T> Ops;
+  const size_t kLanes = Ops::kLanes;
+  const size_t kUnroll = kLanes < 16 ? 4 : 2;
+  const size_t kBlock = kLanes * kUnroll;
+  const unsigned kMask = (1u << kLanes) - 1;
+
+  size_t n = last - first;
+
+  // For small arrays, the scalar loop does all the work
+  if (n < kBlock * 4) {
+    return Rev ? partition_rev<T, T*, Less>(pivot, first, last, Less())
+               : partition<T, T*, Less>(pivot, first, last, Less());
+  }
+
+  typename Ops::Vec p = Ops::splat(pivot);
+
+  // Elements from both ends are saved to make room for the first writes
+  T pending[kBlock * 3];
+  size_t count = 0;
+
+  for (size_t i = 0; i < kBlock; ++i) {
+    pending[count++] = first[i];
+    pending[count++] = last[-1 - ptrdiff_t(i)];
+  }
+
+  T* l = first + kBlock;
+  T* r = last - kBlock;
+  T* wl = first;
+  T* wr = last;
+
+  while (size_t(r - l) >= kBlock) {
+    bool side = l - wl <= wr - r;
+    T* src = side ? l : r - kBlock;
+    l += side ? kBlock : 0;
+    r -= side ? 0 : kBlock;
+
+    typename Ops::Vec v[kUnroll];
+    unsigned m[kUnroll];
+
+    // partition_rev puts x<=pivot to the left, which is !(pivot<x)
+    for (size_t i = 0; i < kUnroll; ++i) {
+      v[i] = Ops::load(src + i * kLanes);
+      m[i] = Rev ? ~Ops::less(p, v[i]) & kMask : Ops::less(v[i], p);
+    }
+
+    for (size_t i = 0; i < kUnroll; ++i) {
+      size_t k = NANOSORT_POPCOUNT(m[i]);
+      Ops::store(wl, wr, v[i], m[i]);
+      wl += k;
+      wr -= kLanes - k;
+    }
+  }
+
+  for (T* it = l; it != r; ++it) pending[count++] = *it;
+
+  first = wl;
+  last = wr;
+
+  assert(size_t(last - first) == count);
+
+  for (size_t i = 0; i < count; ++i) {
+    T x = pending[i];
+    bool left = Rev ? !(pivot < x) : x < pivot;
+    T* dest = left ? first : last - 1;
+    *dest = x;
+    first += left;
+    last -= !left;
+  }
+
+  return first;
+}
+
+#define NANOSORT_SIMD_PARTITION(T)                                         \
+  inline NANOSORT_CONSTEXPR T* partition(T pivot, T* first, T* last,       \
+                                         Less comp) {                      \
+    if (NANOSORT_CONSTANT_EVALUATED())                                     \
+      return partition<T, T*, Less>(pivot, first, last, comp);             \
+    return partition_simd<false>(pivot, first, last);                      \
+  }                                                                        \
+  inline NANOSORT_CONSTEXPR T* partition_rev(T pivot, T* first, T* last,   \
+                                             Less comp) {                  \
+    if (NANOSORT_CONSTANT_EVALUATED())                                     \
+      return partition_rev<T, T*, Less>(pivot, first, last, comp);         \
+    return partition_simd<true>(pivot, first, last);                       \
+  }
+
+NANOSORT_SIMD_PARTITION(int)
+NANOSORT_SIMD_PARTITION(unsigned int)
+NANOSORT_SIMD_PARTITION(long)
+NANOSORT_SIMD_PARTITION(unsigned long)
+#if __cplusplus >= 201103L || defined(_MSC_VER)
+NANOSORT_SIMD_PARTITION(long long)
+NANOSORT_SIMD_PARTITION(unsigned long long)
+#endif
+NANOSORT_SIMD_PARTITION(float)
+NANOSORT_SIMD_PARTITION(double)
+NANOSORT_SIMD_PARTITION(FloatKey<uint32_t>)
+NANOSORT_SIMD_PARTITION(FloatKey<uint64_t>)
+
+#undef NANOSORT_SIMD_PARTITION
+#endif
+
+// Push root down through the heap
+template <typename It, typename Compare>
+void heap_sift(It heap, size_t count, size_t root, Compare comp) {
+  assert(count > 0);
+  size_t last = (count - 1) >> 1;
+
+  while (root < last) {
+    assert(root * 2 + 2 < count);
+
+    size_t next = root;
+    next = comp(heap[next], heap[root * 2 + 1]) ? root * 2 + 1 : next;
+    next = comp(heap[next], heap[root * 2 + 2]) ? root * 2 + 2 : next;
+
+    if (next == root) break;
+    swap(heap[root], heap[next]);
+    root = next;
+  }
+
+  if (root == last && root * 2 + 1 < count &&
+      comp(heap[root], heap[root * 2 + 1])) {
+    swap(heap[root], heap[root * 2 + 1]);
+  }
+}
+
+// Address of the element at it for prefetching; iterators that dereference to
+// proxies provide an overload
+template <typename It>
+const void* element_address(It it) {
+  return &*it;
+}
+
+// Sift value from root of a 4-ary heap, where children of node i are 4i+1..4i+4.
+// The hole moves down to a leaf along the largest children and then value
+// moves up from the leaf (Floyd's method); value is usually small so it ends up
+// near the bottom, which saves a comparison with value on every level
+template <typename T, typename It, typename Compare>
+NANOSORT_CONSTEXPR void heap_sift4(It heap, size_t count, size_t root, T& value,
+                                   Compare comp) {
+  size_t hole = root;
+
+  while (hole * 4 + 4 < count) {
+    size_t child = hole * 4 + 1;
+
+    // Next level only needs children of the hole's children, which are 16
+    // adjacent elements, so for large heaps they are prefetched early
+    size_t grand = child * 4 + 1;
+    if (grand + 15 < count && !NANOSORT_CONSTANT_EVALUATED()) {
+      NANOSORT_PREFETCH(element_address(heap + grand));
+      NANOSORT_PREFETCH(element_address(heap + grand + 15));
+    }
+
+    size_t a = child + comp(heap[child], heap[child + 1]);
+    size_t b = child + 2 + comp(heap[child + 2], heap[child + 3]);
+    size_t next = a ^ ((a ^ b) & (0 - size_t(comp(heap[a], heap[b]))));
+
+    heap[hole] = NANOSORT_MOVE(heap[next]);
+    hole = next;
+  }
+
+  if (hole * 4 + 1 < count) {
+    size_t next = hole * 4 + 1;
+    for (size_t i = next + 1; i < count; ++i)
+      next = comp(heap[next], heap[i]) ? i : next;
+
+    heap[hole] = NANOSORT_MOVE(heap[next]);
+    hole = next;
+  }
+
+  while (hole > root) {
+    size_t parent = (hole - 1) / 4;
+    if (!comp(heap[parent], value)) break;
+
+    heap[hole] = NANOSORT_MOVE(heap[parent]);
+    hole = parent;
+  }
+
+  heap[hole] = NANOSORT_MOVE(value);
+}
+
+// Sort array using heap sort
+template <typename It, typename Compare>
+NANOSORT_CONSTEXPR void heap_sort(It first, It last, Compare comp) {
+  typedef typename IteratorTraits<It>::value_type T;
+
+  if (last - first < 2) return;
+
+  It heap = first;
+  size_t count = last - first;
+
+  for (size_t i = (count + 2) / 4; i > 0; --i) {
+    T value = NANOSORT_MOVE(heap[i - 1]);
+    heap_sift4(heap, count, i - 1, value, comp);
+  }
+
+  for (size_t i = count - 1; i > 0; --i) {
+    T value = NANOSORT_MOVE(heap[i]);
+    heap[i] = NANOSORT_MOVE(heap[0]);
+    heap_sift4(heap, i, 0, value, comp);
+  }
+}
+
+template <typename T, typename It, typename Compare>
+NANOSORT_CONSTEXPR void small_sort(It first, It last, Compare comp) {
+  size_t n = last - first;
+
+  for (size_t i = n; i > 1; i -= 2) {
+    T x = NANOSORT_MOVE(first[0]);
+    T y = NANOSORT_MOVE(first[1]);
+    if (comp(y, x)) swap(y, x);
+
+    for (size_t j = 2; j < i; j++) {
+      T z = NANOSORT_MOVE(first[j]);
+
+      if (comp(x, z)) swap(x, z);
+      if (comp(y, z)) swap(y, z);
+      if (comp(y, x)) swap(y, x);
+
+      first[j - 2] = NANOSORT_MOVE(z);
+    }
+
+    first[i - 2] = NANOSORT_MOVE(x);
+    first[i - 1] = NANOSORT_MOVE(y);
+  }
+}
+
+#ifdef NANOSORT_SIMD
+template <bool Simd>
+struct SmallSortSimd {
+  template <typename T>
+  static bool run(T*, T*) {
+    return false;
+  }
+};
+
+template <>
+struct SmallSortSimd<true> {
+  // Below 8 elements the network costs more than the scalar sort
+  template <typename T>
+  static bool run(T* first, T* last) {
+    size_t n = last - first;
+    return n >= 8 && n <= 16 && small_sort_simd(first, last);
+  }
+};
+
+// Primitive types use a sorting network when sorted with default comparator
+template <typename T>
+NANOSORT_CONSTEXPR void small_sort(T* first, T* last, Less comp) {
+  if (!NANOSORT_CONSTANT_EVALUATED() &&
+      SmallSortSimd<SimdEnabled<T>::value>::run(first, last))
+    return;
+
+  small_sort<T, T*, Less>(first, last, comp);
+}
+#endif
+
+// Arrays larger than this many bytes are partitioned using two pivots
+const size_t kPartition3Bytes = 1 << 20;
+
+// Sort a sample of 15 evenly spaced elements and move it to the start of the
+// array, so that pivots can be taken from its quantiles
+template <typename T, typename It, typename Compare>
+NANOSORT_CONSTEXPR void sample15(It first, It last, Compare comp) {
+  size_t step = (last - first) / 15;
+  assert(step >= 15);
+
+  for (size_t i = 1; i < 15; ++i) swap(first[i], first[i * step]);
+
+  small_sort<T>(first, first + 15, comp);
+}
+
+// Number of elements small_sort writes to the array; every pass writes back
+// the part that is still unsorted
+NANOSORT_CONSTEXPR size_t small_sort_moves(size_t n) {
+  size_t result = 0;
+  for (size_t i = n; i > 1; i -= 2) result += i;
+  return result;
+}
+
+// Statistics policy that doesn't record anything, which makes instrumentation
+// free when statistics aren't needed
+struct NoStats {
+  NANOSORT_CONSTEXPR NoStats child() const { return NoStats(); }
+
+  NANOSORT_CONSTEXPR void partitioned(size_t) const {}
+  NANOSORT_CONSTEXPR void moved(size_t) const {}
+  NANOSORT_CONSTEXPR void skewed() const {}
+  NANOSORT_CONSTEXPR void heap_sorted(size_t) const {}
+  NANOSORT_CONSTEXPR void small_sorted(size_t) const {}
+};
+
+// Statistics policy that records into nanosort_stats; each level of recursion
+// gets a copy with a larger depth so that depth doesn't need to be restored
+struct StatsRecorder {
+  nanosort_stats* stats;
+  size_t depth;
+
+  StatsRecorder child() const {
+    StatsRecorder result = {stats, depth + 1};
+    if (stats->max_depth < result.depth) stats->max_depth = result.depth;
+    return result;
+  }
+
+  void partitioned(size_t n) const {
+    stats->partitions++;
+    stats->partition_elements += n;
+  }
+
+  void moved(size_t n) const { stats->moves += n; }
+
+  void skewed() const { stats->skewed_partitions++; }
+
+  void heap_sorted(size_t n) const {
+    stats->heap_sorts++;
+    stats->heap_sort_elements += n;
+  }
+
+  void small_sorted(size_t n) const {
+    stats->small_sorts[n]++;
+    stats->moves += small_sort_moves(n);
+  }
+};
+
+template <typename Compare>
+struct CountingCompare {
+  Compare comp;
+  size_t* count;
+
+  template <typename T>
+  bool operator()(const T& l, const T& r) const {
+    ++*count;
+    return comp(l, r);
+  }
+};
+
+// Same as sort, but keeps the pivot in the array and uses block partition so
+// that only misplaced elements are moved
+template <typename T, typename It, typename Compare, typename Stats>
+void sort_block(It first, It last, size_t limit, Compare comp, Stats stats) {
+  for (;;) {
+    if (last - first < 16) {
+      stats.small_sorted(last - first);
+      small_sort<T>(first, last, comp);
+      return;
+    }
+
+    if (NANOSORT_UNLIKELY(limit == 0)) {
+      stats.heap_sorted(last - first);
+      heap_sort(first, last, comp);
+      return;
+    }
+
+    stats.partitioned(last - first);
+
+    It pivot = median5_ref(first, last, comp);
+    if (pivot != first) {
+      swap(*first, *pivot);
+      stats.moved(2);
+    }
+
+    // After partition, pivot moves to the end of the left part
+    It mid = partition_block(first + 1, last,
+                             PivotLess<T, Compare>(*first, comp), stats);
+    if (mid - 1 != first) {
+      swap(*first, *(mid - 1));
+      stats.moved(2);
+    }
+
+    It midl = mid - 1;
+
+    // For skewed partitions compute new midpoint by separating equal elements
+    It midr = mid;
+    if (NANOSORT_UNLIKELY(midl - first <= (last - first) >> 3)) {
+      stats.skewed();
+      midr = partition_block(mid, last,
+                             PivotLessEqual<T, Compare>(*midl, comp), stats);
+    }
+
+    // Per MSVC STL, this allows 1.5 log2(N) recursive steps
+    limit = (limit >> 1) + (limit >> 2);
+    stats = stats.child();
+
+    if (midl - first <= last - midr) {
+      sort_block<T>(first, midl, limit, comp, stats);
+      first = midr;
+    } else {
+      sort_block<T>(midr, last, limit, comp, stats);
+      last = midl;
+    }
+  }
+}
+
+template <bool Trivial>
+struct SortBlock {
+  template <typename T, typename It, typename Compare, typename Stats>
+  NANOSORT_CONSTEXPR static bool run(It first, It last, size_t limit,
+                                     Compare comp, Stats stats) {
+    sort_block<T>(first, last, limit, comp, stats);
+    return true;
+  }
+};
+
+template <>
+struct SortBlock<true> {
+  template <typename T, typename It, typename Compare, typename Stats>
+  NANOSORT_CONSTEXPR static bool run(It, It, size_t, Compare, Stats) {
+    return false;
+  }
+};
+
+template <typename T, typename It, typename Compare, typename Stats>
+NANOSORT_CONSTEXPR void sort(It first, It last, size_t limit, Compare comp,
+                             Stats stats) {
+  if (SortBlock<IsTrivial<T>::value>::template run<T>(first, last, limit, comp,
+                                                      stats))
+    return;
+
+  bool dual = true;
+
+  for (;;) {
+    if (last - first < 16) {
+      stats.small_sorted(last - first);
+      small_sort<T>(first, last, comp);
+      return;
+    }
+
+    if (NANOSORT_UNLIKELY(limit == 0)) {
+      stats.heap_sorted(last - first);
+      heap_sort(first, last, comp);
+      return;
+    }
+
+    stats.partitioned(last - first);
+
+    size_t n = last - first;
+
+    // Large elements are expensive to move, so arrays that don't fit in cache
+    // are split in three parts per pass to reduce passes over memory; for
+    // smaller elements two-way partition executes fewer instructions
+    if (dual && sizeof(T) > 16 && n > kPartition3Bytes / sizeof(T)) {
+      sample15<T>(first, last, comp);
+      stats.moved(14 * 2 + small_sort_moves(15));
+
+      T p1 = first[4];
+      T p2 = first[10];
+
+      It midl, midr;
+      partition3(p1, p2, first, last, midl, midr, comp);
+      stats.moved(n * 3);
+
+      limit = (limit >> 1) + (limit >> 2);
+      stats = stats.child();
+
+      // With equal pivots, middle part has elements equal to pivots
+      size_t nl = midl - first;
+      size_t nm = comp(p1, p2) ? midr - midl : 0;
+      size_t nr = last - midr;
+
+      if (nm >= nl && nm >= nr) {
+        sort<T>(first, midl, limit, comp, stats);
+        sort<T>(midr, last, limit, comp, stats);
+        first = midl;
+        last = midr;
+
+        // Elements of skewed middle part are likely to produce the same
+        // pivots again, so the next pass uses one pivot instead
+        if (NANOSORT_UNLIKELY(nl + nr <= n >> 3)) {
+          stats.skewed();
+          dual = false;
+        }
+      } else if (nl >= nr) {
+        sort<T>(midl, midl + nm, limit, comp, stats);
+        sort<T>(midr, last, limit, comp, stats);
+        last = midl;
+      } else {
+        sort<T>(first, midl, limit, comp, stats);
+        sort<T>(midl, midl + nm, limit, comp, stats);
+        first = midr;
+      }
+
+      continue;
+    }
+
+    T pivot = median5<T>(first, last, comp);
+    It mid = partition(pivot, first, last, comp);
+    stats.moved(n * 2);
+
+    // For skewed partitions compute new midpoint by separating equal elements
+    It midr = mid;
+    if (NANOSORT_UNLIKELY(mid - first <= (last - first) >> 3)) {
+      stats.skewed();
+      stats.moved((last - mid) * 2);
+      midr = partition_rev(pivot, mid, last, comp);
+    }
+
+    // Per MSVC STL, this allows 1.5 log2(N) recursive steps
+    limit = (limit >> 1) + (limit >> 2);
+    stats = stats.child();
+
+    if (mid - first <= last - midr) {
+      sort<T>(first, mid, limit, comp, stats);
+      first = midr;
+    } else {
+      sort<T>(midr, last, limit, comp, stats);
+      last = mid;
+    }
+  }
+}
+
+template <typename T, typename It, typename Compare>
+NANOSORT_CONSTEXPR void sort(It first, It last, size_t limit, Compare comp) {
+  sort<T>(first, last, limit, comp, NoStats());
+}
+
+// Moves the first element of each group of equal elements in sorted
+// [first, last) to out, which must not be after first; returns end of output
+template <typename It, typename Compare>
+It unique_move(It first, It last, It out, Compare comp) {
+  if (first == last) return out;
+
+  *out = NANOSORT_MOVE(*first);
+
+  for (It it = first + 1; it != last; ++it)
+    if (comp(*out, *it)) *++out = NANOSORT_MOVE(*it);
+
+  return ++out;
+}
+
+// Sorts [first, last) with insertion sort, moving one element of each group of
+// equal elements to out, which must not be after first; duplicates are dropped
+// as they are found, so they are never moved into the sorted part
+template <typename T, typename It, typename Compare>
+It small_sort_unique(It first, It last, It out, Compare comp) {
+  It end = out;
+
+  for (It it = first; it != last; ++it) {
+    It hole = end;
+    while (hole != out && comp(*it, *(hole - 1))) --hole;
+
+    if (hole != out && !comp(*(hole - 1), *it)) continue;
+
+    T val = NANOSORT_MOVE(*it);
+    for (It j = end; j != hole; --j) *j = NANOSORT_MOVE(*(j - 1));
+
+    *hole = NANOSORT_MOVE(val);
+    ++end;
+  }
+
+  return end;
+}
+
+// Same as sort, but moves one element of each group of equal elements to out,
+// which must not be after first, and returns end of output. All elements are
+// not less than *bound when it's set; a pivot that is equal to it is the
+// smallest element, so all elements equal to it are collapsed with one pass.
+// Since every partition passes its pivot as the bound of the right part, the
+// work on inputs with many duplicates depends on the number of distinct
+// elements
+template <typename T, typename It, typename Compare>
+It sort_unique(It first, It last, It out, size_t limit, Compare comp,
+               const T* bound) {
+  if (last - first < 16) return small_sort_unique<T>(first, last, out, comp);
+
+  if (NANOSORT_UNLIKELY(limit == 0)) {
+    heap_sort(first, last, comp);
+    return unique_move(first, last, out, comp);
+  }
+
+  T pivot = median5<T>(first, last, comp);
+
+  // Per MSVC STL, this allows 1.5 log2(N) recursive steps
+  limit = (limit >> 1) + (limit >> 2);
+
+  if (bound && !comp(*bound, pivot)) {
+    It mid = partition_rev(pivot, first, last, comp);
+
+    // Comparison functions that don't use strict weak ordering may leave
+    // this part empty
+    if (mid != first) *out++ = NANOSORT_MOVE(*first);
+
+    return sort_unique<T>(mid, last, out, limit, comp, bound);
+  }
+
+  It mid = partition(pivot, first, last, comp);
+
+  // Output of the left part ends before mid, so the rest stays intact
+  out = sort_unique<T>(first, mid, out, limit, comp, bound);
+
+  return sort_unique<T>(mid, last, out, limit, comp, &pivot);
+}
+
+// Rearrange array so that nth is in its sorted position, using median of
+// medians as a pivot to guarantee linear time
+template <typename T, typename It, typename Compare>
+void select_nth_mom(It first, It nth, It last, Compare comp) {
+  while (last - first >= 16) {
+    size_t n = last - first;
+    size_t groups = n / 5;
+
+    // Median of each group of 5 is moved to the front
+    for (size_t i = 0; i < groups; ++i) {
+      small_sort<T>(first + i * 5, first + i * 5 + 5, comp);
+      swap(first[i], first[i * 5 + 2]);
+    }
+
+    select_nth_mom<T>(first, first + groups / 2, first + groups, comp);
+
+    T pivot = first[groups / 2];
+    It mid = partition(pivot, first, last, comp);
+    It midr = partition_rev(pivot, mid, last, comp);
+
+    // Comparison functions that don't use strict weak ordering may not make
+    // progress, in which case the result is unspecified
+    if (NANOSORT_UNLIKELY(nth < mid ? mid == last : midr == first)) break;
+
+    if (nth < mid)
+      last = mid;
+    else if (nth >= midr)
+      first = midr;
+    else
+      return;
+  }
+
+  small_sort<T>(first, last, comp);
+}
+
+// Rearrange array so that nth is in its sorted position, elements before nth
+// are not greater and elements after nth are not less than *nth
+template <typename T, typename It, typename Compare>
+void select_nth(It first, It nth, It last, size_t limit, Compare comp) {
+  while (last - first >= 16) {
+    if (NANOSORT_UNLIKELY(limit == 0)) {
+      select_nth_mom<T>(first, nth, last, comp);
+      return;
+    }
+
+    T pivot = median5<T>(first, last, comp);
+    It mid = partition(pivot, first, last, comp);
+
+    // For skewed partitions compute new midpoint by separating equal elements
+    It midr = mid;
+    if (NANOSORT_UNLIKELY(mid - first <= (last - first) >> 3)) {
+      midr = partition_rev(pivot, mid, last, comp);
+    }
+
+    // Per MSVC STL, this allows 1.5 log2(N) recursive steps
+    limit = (limit >> 1) + (limit >> 2);
+
+    if (nth < mid)
+      last = mid;
+    else if (nth >= midr)
+      first = midr;
+    else
+      return;
+  }
+
+  small_sort<T>(first, last, comp);
+}
+
+// Sort the smallest middle-first elements into [first, middle) using a heap
+// of these elements; this is faster than select_nth when there are few of them
+// since most elements are rejected after one comparison
+template <typename It, typename Compare>
+void partial_heap(It first, It middle, It last, Compare comp) {
+  size_t count = middle - first;
+
+  for (size_t i = count / 2; i > 0; --i) {
+    heap_sift(first, count, i - 1, comp);
+  }
+
+  for (It it = middle; it != last; ++it) {
+    if (comp(*it, *first)) {
+      swap(*first, *it);
+      heap_sift(first, count, 0, comp);
+    }
+  }
+
+  for (size_t i = count - 1; i > 0; --i) {
+    swap(first[0], first[i]);
+    heap_sift(first, i, 0, comp);
+  }
+}
+
+// Same as select_nth for several positions base+ranks[i], which must be in
+// ascending order; each partition splits the list of ranks between both sides
+template <typename T, typename It, typename RankIt, typename Compare>
+void select_ranks(It base, It first, It last, RankIt rfirst, RankIt rlast,
+                  size_t limit, Compare comp) {
+  for (;;) {
+    if (rfirst == rlast) return;
+
+    if (last - first < 16) {
+      small_sort<T>(first, last, comp);
+      return;
+    }
+
+    if (NANOSORT_UNLIKELY(limit == 0)) {
+      for (RankIt r = rfirst; r != rlast; ++r) {
+        It nth = base + *r;
+        if (nth < first) continue;
+
+        select_nth_mom<T>(first, nth, last, comp);
+        first = nth + 1;
+      }
+      return;
+    }
+
+    T pivot = median5<T>(first, last, comp);
+    It mid = partition(pivot, first, last, comp);
+
+    // For skewed partitions compute new midpoint by separating equal elements
+    It midr = mid;
+    if (NANOSORT_UNLIKELY(mid - first <= (last - first) >> 3)) {
+      midr = partition_rev(pivot, mid, last, comp);
+    }
+
+    // Per MSVC STL, this allows 1.5 log2(N) recursive steps
+    limit = (limit >> 1) + (limit >> 2);
+
+    RankIt rmid = rfirst;
+    while (rmid != rlast && base + *rmid < mid) ++rmid;
+
+    RankIt rmidr = rmid;
+    while (rmidr != rlast && base + *rmidr < midr) ++rmidr;
+
+    select_ranks<T>(base, first, mid, rfirst, rmid, limit, comp);
+
+    first = midr;
+    rfirst = rmidr;
+  }
+}
+
+// Segments are grouped by size in chunks of this many consecutive segments
+const size_t kSegmentChunk = 256;
+
+// Segments below this size are sorted with sorting networks
+const size_t kSegmentNetwork = 16;
+
+// Sorts segments in list of each size below N + 1 with a sorting network; list
+// has segments of size k in [start[k], start[k+1])
+template <int N>
+struct SortSegmentNetworks {
+  template <typename T, typename It, typename OffsetIt, typename Compare>
+  static void run(It data, OffsetIt offsets, const unsigned char* list,
+                  const size_t* start, Compare comp) {
+    SortSegmentNetworks<N - 1>::template run<T>(data, offsets, list, start,
+                                                comp);
+
+    for (size_t i = start[N]; i < start[N + 1]; ++i)
+      sort_fixed<N, T>(data + offsets[list[i]], comp);
+  }
+};
+
+template <>
+struct SortSegmentNetworks<1> {
+  template <typename T, typename It, typename OffsetIt, typename Compare>
+  static void run(It, OffsetIt, const unsigned char*, const size_t*,
+                  Compare) {}
+};
+
+// Small segments of trivial types are grouped by size and sorted with sorting
+// networks; since the size of the next segment is hard to predict, this avoids
+// mispredicted branches both in small_sort and in choosing the network, and
+// networks of consecutive segments of the same size don't depend on each other
+// so they execute in parallel. With random 32-bit keys in 1M elements, this
+// takes 4.6 instead of 16.6 ns/element for segments of 1-16 elements and 2.1
+// instead of 12.3 for segments of 8 elements (1.5 instead of 2.7 with AVX2)
+template <bool Trivial>
+struct SortSegments {
+  template <typename T, typename It, typename OffsetIt, typename Compare>
+  static void run(It data, OffsetIt offsets, size_t count, Compare comp) {
+    for (size_t base = 0; base < count; base += kSegmentChunk) {
+      size_t chunk = count - base < kSegmentChunk ? count - base : kSegmentChunk;
+      OffsetIt chunk_offsets = offsets + base;
+
+      // Larger segments go to the last group
+      unsigned char sizes[kSegmentChunk];
+      size_t start[kSegmentNetwork + 2] = {};
+
+      for (size_t i = 0; i < chunk; ++i) {
+        size_t size = chunk_offsets[i + 1] - chunk_offsets[i];
+        sizes[i] = (unsigned char)(size < kSegmentNetwork ? size
+                                                          : kSegmentNetwork);
+        start[sizes[i] + 1]++;
+      }
+
+      for (size_t k = 0; k <= kSegmentNetwork; ++k) start[k + 1] += start[k];
+
+      unsigned char list[kSegmentChunk];
+      size_t fill[kSegmentNetwork + 1];
+      for (size_t k = 0; k <= kSegmentNetwork; ++k) fill[k] = start[k];
+
+      for (size_t i = 0; i < chunk; ++i)
+        list[fill[sizes[i]]++] = (unsigned char)(i);
+
+      SortSegmentNetworks<kSegmentNetwork - 1>::template run<T>(
+          data, chunk_offsets, list, start, comp);
+
+      for (size_t i = start[kSegmentNetwork]; i < chunk; ++i) {
+        It first = data + chunk_offsets[list[i]];
+        It last = data + chunk_offsets[list[i] + 1];
+
+        sort<T>(first, last, last - first, comp);
+      }
+    }
+  }
+};
+
+// Other types are cheaper to sort with small_sort, which moves fewer elements;
+// small segments skip the checks in sort
+template <>
+struct SortSegments<false> {
+  template <typename T, typename It, typename OffsetIt, typename Compare>
+  static void run(It data, OffsetIt offsets, size_t count, Compare comp) {
+    for (size_t i = 0; i < count; ++i) {
+      It first = data + offsets[i];
+      It last = data + offsets[i + 1];
+
+      if (last - first < 16)
+        small_sort<T>(first, last, comp);
+      else
+        sort<T>(first, last, last - first, comp);
+    }
+  }
+};
+
+// Sort segments [offsets[i], offsets[i+1]) of data
+template <typename T, typename It, typename OffsetIt, typename Compare>
+void sort_segments(It data, OffsetIt offsets, size_t count, Compare comp) {
+  SortSegments<IsTrivial<T>::value>::template run<T>(data, offsets, count,
+                                                      comp);
+}
+
+// Stable version of small_sort; the two largest elements are carried along
+// with ties resolved in favor of the element that came first
+template <typename T, typename It, typename Compare>
+void small_sort_stable(It first, It last, Compare comp) {
+  size_t n = last - first;
+
+  for (size_t i = n; i > 1; i -= 2) {
+    T x = NANOSORT_MOVE(first[0]);
+    T y = NANOSORT_MOVE(first[1]);
+    if (comp(y, x)) swap(y, x);
+
+    for (size_t j = 2; j < i; j++) {
+      T z = NANOSORT_MOVE(first[j]);
+
+      bool zx = comp(z, x);
+      bool zy = comp(z, y);
+
+      // Output the smallest of x, y, z and keep the other two ordered
+      if (!zx) swap(x, z);
+      if (!zy) swap(x, y);
+
+      first[j - 2] = NANOSORT_MOVE(z);
+    }
+
+    first[i - 2] = NANOSORT_MOVE(x);
+    first[i - 1] = NANOSORT_MOVE(y);
+  }
+}
+
+// Merge sorted ranges into out; elements from the right range are only taken
+// when they are less than elements from the left range to keep the order
+template <typename It, typename OutIt, typename Compare>
+OutIt merge_runs(It l, It lend, It r, It rend, OutIt out, Compare comp) {
+  while (l != lend && r != rend) {
+    bool c = comp(*r, *l);
+    *out = NANOSORT_MOVE(c ? *r : *l);
+    ++out;
+    r += c;
+    l += !c;
+  }
+
+  while (l != lend) *out = NANOSORT_MOVE(*l), ++out, ++l;
+  while (r != rend) *out = NANOSORT_MOVE(*r), ++out, ++r;
+
+  return out;
+}
+
+// Merge runs of equal length from both ends at once, which halves the length
+// of the dependency chain; elements are copied and the result is only valid if
+// both ends meet, which may not happen if comp isn't a strict weak ordering
+template <bool Trivial>
+struct MergeBoth {
+  template <typename It, typename OutIt, typename Compare>
+  static bool run(It, It, size_t, OutIt, Compare) {
+    return false;
+  }
+};
+
+template <>
+struct MergeBoth<true> {
+  template <typename It, typename OutIt, typename Compare>
+  static bool run(It l, It r, size_t m, OutIt out, Compare comp) {
+    It le = r, re = r + m;
+    OutIt oe = out + m * 2;
+
+    for (size_t i = 0; i < m; ++i) {
+      bool c = comp(*r, *l);
+      *out = c ? *r : *l;
+      ++out;
+      r += c;
+      l += !c;
+
+      bool d = comp(re[-1], le[-1]);
+      --oe;
+      *oe = d ? le[-1] : re[-1];
+      le -= d;
+      re -= !d;
+    }
+
+    return l == le && r == re;
+  }
+};
+
+template <typename T, typename It, typename OutIt, typename Compare>
+void merge_pass(It first, size_t n, size_t width, OutIt out, Compare comp) {
+  for (size_t i = 0; i < n; i += width * 2) {
+    size_t mid = i + width < n ? i + width : n;
+    size_t end = i + width * 2 < n ? i + width * 2 : n;
+
+    if (end - mid == width &&
+        MergeBoth<IsTrivial<T>::value>::run(first + i, first + mid, width,
+                                            out + i, comp))
+      continue;
+
+    merge_runs(first + i, first + mid, first + mid, first + end, out + i,
+               comp);
+  }
+}
+
+// Bottom-up merge sort that sorts small runs in place and then merges them
+// back and forth between the array and scratch
+template <typename T, typename It, typename ScratchIt, typename Compare>
+void merge_sort(It first, It last, ScratchIt scratch, Compare comp) {
+  const size_t kRun = 16;
+
+  size_t n = last - first;
+
+  for (size_t i = 0; i < n; i += kRun)
+    small_sort_stable<T>(first + i, first + (n - i < kRun ? n : i + kRun),
+                         comp);
+
+  bool flipped = false;
+
+  for (size_t width = kRun; width < n; width *= 2) {
+    if (flipped)
+      merge_pass<T>(scratch, n, width, first, comp);
+    else
+      merge_pass<T>(first, n, width, scratch, comp);
+
+    flipped = !flipped;
+  }
+
+  if (flipped) {
+    for (size_t i = 0; i < n; ++i) first[i] = NANOSORT_MOVE(scratch[i]);
+  }
+}
+
+// Maps arithmetic keys to unsigned integers with the same order
+template <typename T>
+struct RadixTraits;
+
+template <typename T, typename U>
+struct RadixUnsigned {
+  typedef U Key;
+  static Key encode(T v) { return Key(v); }
+};
+
+template <typename T, typename U>
+struct RadixSigned {
+  typedef U Key;
+  static Key encode(T v) {
+    return Key(v) ^ (Key(1) << (sizeof(Key) * 8 - 1));
+  }
+};
+
+// Negative floats have all bits flipped, positive floats have sign flipped
+template <typename T, typename U>
+struct RadixFloat {
+  typedef U Key;
+  static Key encode(T v) {
+    Key k;
+    memcpy(&k, &v, sizeof(k));
+    Key sign = Key(1) << (sizeof(Key) * 8 - 1);
+    return k ^ ((k & sign) ? ~Key(0) : sign);
+  }
+  static T decode(Key k) {
+    Key sign = Key(1) << (sizeof(Key) * 8 - 1);
+    k ^= (k & sign) ? sign : ~Key(0);
+    T v;
+    memcpy(&v, &k, sizeof(k));
+    return v;
+  }
+};
+
+// clang-format off
+template <bool Signed> struct RadixChar : RadixUnsigned<char, uint8_t> {};
+template <> struct RadixChar<true> : RadixSigned<char, uint8_t> {};
+
+template <> struct RadixTraits<bool> : RadixUnsigned<bool, uint8_t> {};
+template <> struct RadixTraits<char> : RadixChar<(char(-1) < 0)> {};
+template <> struct RadixTraits<unsigned char> : RadixUnsigned<unsigned char, uint8_t> {};
+template <> struct RadixTraits<unsigned short> : RadixUnsigned<unsigned short, uint16_t> {};
+template <> struct RadixTraits<unsigned int> : RadixUnsigned<unsigned int, uint32_t> {};
+template <> struct RadixTraits<unsigned long> : RadixUnsigned<unsigned long, unsigned long> {};
+template <> struct RadixTraits<signed char> : RadixSigned<signed char, uint8_t> {};
+template <> struct RadixTraits<short> : RadixSigned<short, uint16_t> {};
+template <> struct RadixTraits<int> : RadixSigned<int, uint32_t> {};
+template <> struct RadixTraits<long> : RadixSigned<long, unsigned long> {};
+#if __cplusplus >= 201103L || defined(_MSC_VER)
+template <> struct RadixTraits<unsigned long long> : RadixUnsigned<unsigned long long, unsigned long long> {};
+template <> struct RadixTraits<long long> : RadixSigned<long long, unsigned long long> {};
+#endif
+template <> struct RadixTraits<float> : RadixFloat<float, uint32_t> {};
+template <> struct RadixTraits<double> : RadixFloat<double, uint64_t> {};
+// clang-format on
+
+// Floating point arrays passed as pointers and sorted with the default
+// comparator are converted in place to integer keys that have the same order,
+// sorted as integers and converted back. Integer comparisons are cheaper and
+// vectorize better, and keys order values according to IEEE 754 totalOrder: -0
+// goes before +0, NaNs with the sign bit set go first and other NaNs go last.
+// Keys are accessed through FloatKey so that this doesn't break strict aliasing
+template <typename T>
+void sort_float(T* first, T* last) {
+  typedef FloatKey<typename RadixTraits<T>::Key> Key;
+
+  size_t n = last - first;
+
+  for (size_t i = 0; i < n; ++i) {
+    Key k = {RadixTraits<T>::encode(first[i])};
+    memcpy(first + i, &k, sizeof(k));
+  }
+
+  Key* keys = reinterpret_cast<Key*>(first);
+  sort<Key>(keys, keys + n, n, Less());
+
+  for (size_t i = 0; i < n; ++i) {
+    Key k;
+    memcpy(&k, first + i, sizeof(k));
+    first[i] = RadixTraits<T>::decode(k.value);
+  }
+}
+
+template <typename It>
+NANOSORT_CONSTEXPR void sort_less(It first, It last) {
+  typedef typename IteratorTraits<It>::value_type T;
+  sort<T>(first, last, last - first, Less());
+}
+
+inline NANOSORT_CONSTEXPR void sort_less(float* first, float* last) {
+  if (NANOSORT_CONSTANT_EVALUATED())
+    sort<float>(first, last, last - first, Less());
+  else
+    sort_float(first, last);
+}
+
+inline NANOSORT_CONSTEXPR void sort_less(double* first, double* last) {
+  if (NANOSORT_CONSTANT_EVALUATED())
+    sort<double>(first, last, last - first, Less());
+  else
+    sort_float(first, last);
+}
+
+struct Identity {
+  template <typename T>
+  const T& operator()(const T& v) const {
+    return v;
+  }
+};
+
+// Compare elements using encoded keys, which matches the radix order
+template <typename Key, typename KeyFn>
+struct RadixCompare {
+  KeyFn keyfn;
+
+  explicit RadixCompare(KeyFn keyfn_) : keyfn(keyfn_) {}
+
+  template <typename T>
+  bool operator()(const T& l, const T& r) const {
+    return RadixTraits<Key>::encode(keyfn(l)) <
+           RadixTraits<Key>::encode(keyfn(r));
+  }
+};
+
+// Buckets smaller than this are sorted using comparison sort
+const size_t kRadixThreshold = 128;
+
+// MSD radix sort that permutes elements in place (American flag sort)
+template <typename T, typename Key, typename It, typename KeyFn>
+void radix_sort(It first, It last, int shift, KeyFn keyfn) {
+  typedef RadixTraits<Key> Traits;
+
+  for (;;) {
+    size_t n = last - first;
+
+    if (n < kRadixThreshold) {
+      sort<T>(first, last, n, RadixCompare<Key, KeyFn>(keyfn));
+      return;
+    }
+
+    size_t count[256] = {};
+    for (It it = first; it != last; ++it) {
+      count[(Traits::encode(keyfn(*it)) >> shift) & 255]++;
+    }
+
+    // Skip the digit altogether if all elements share it
+    size_t digit0 = (Traits::encode(keyfn(*first)) >> shift) & 255;
+    if (count[digit0] == n) {
+      if (shift == 0) return;
+      shift -= 8;
+      continue;
+    }
+
+    size_t head[256], tail[256];
+    size_t offset = 0;
+    for (size_t b = 0; b < 256; ++b) {
+      head[b] = offset;
+      offset += count[b];
+      tail[b] = offset;
+    }
+
+    for (size_t b = 0; b < 256; ++b) {
+      while (head[b] < tail[b]) {
+        T x = NANOSORT_MOVE(first[head[b]]);
+        size_t d = (Traits::encode(keyfn(x)) >> shift) & 255;
+
+        while (d != b) {
+          swap(x, first[head[d]++]);
+          d = (Traits::encode(keyfn(x)) >> shift) & 255;
+        }
+
+        first[head[b]++] = NANOSORT_MOVE(x);
+      }
+    }
+
+    if (shift == 0) return;
+
+    for (size_t b = 0, start = 0; b < 256; start += count[b], ++b) {
+      if (count[b] > 1) {
+        radix_sort<T, Key>(first + start, first + start + count[b], shift - 8,
+                           keyfn);
+      }
+    }
+
+    return;
+  }
+}
+
+// LSD radix sort that moves elements between array and scratch buffer
+template <typename Key, typename It, typename ScratchIt, typename KeyFn>
+void radix_sort_lsd(It first, It last, ScratchIt scratch, KeyFn keyfn) {
+  typedef RadixTraits<Key> Traits;
+  typedef typename Traits::Key Bits;
+
+  const int kDigits = sizeof(Bits);
+  size_t n = last - first;
+
+  size_t count[kDigits][256] = {};
+  for (It it = first; it != last; ++it) {
+    Bits k = Traits::encode(keyfn(*it));
+
+    for (int d = 0; d < kDigits; ++d) count[d][(k >> (d * 8)) & 255]++;
+  }
+
+  bool flipped = false;
+
+  for (int d = 0; d < kDigits; ++d) {
+    // Skip the digit altogether if all elements share it
+    size_t digit0 = (Traits::encode(keyfn(*first)) >> (d * 8)) & 255;
+    if (count[d][digit0] == n) continue;
+
+    size_t offset[256];
+    for (size_t b = 0, sum = 0; b < 256; ++b) {
+      offset[b] = sum;
+      sum += count[d][b];
+    }
+
+    if (flipped) {
+      for (ScratchIt it = scratch; it != scratch + n; ++it) {
+        size_t b = (Traits::encode(keyfn(*it)) >> (d * 8)) & 255;
+        first[offset[b]++] = NANOSORT_MOVE(*it);
+      }
+    } else {
+      for (It it = first; it != last; ++it) {
+        size_t b = (Traits::encode(keyfn(*it)) >> (d * 8)) & 255;
+        scratch[offset[b]++] = NANOSORT_MOVE(*it);
+      }
+    }
+
+    flipped = !flipped;
+  }
+
+  if (flipped) {
+    for (size_t i = 0; i < n; ++i) first[i] = NANOSORT_MOVE(scratch[i]);
+  }
+}
+
+// Key type is deduced from the key function result using the last argument
+template <typename T, typename It, typename KeyFn, typename Key>
+void radix_sort_key(It first, It last, KeyFn keyfn, const Key&) {
+  radix_sort<T, Key>(first, last, int(sizeof(Key) * 8 - 8), keyfn);
+}
+
+template <typename It, typename ScratchIt, typename KeyFn, typename Key>
+void radix_sort_key(It first, It last, ScratchIt scratch, KeyFn keyfn,
+                    const Key&) {
+  radix_sort_lsd<Key>(first, last, scratch, keyfn);
+}
+
+// Temporary array that is freed when it goes out of scope
+template <typename T>
+class Buffer {
+ public:
+  explicit Buffer(size_t size) : data(new T[size]) {}
+  ~Buffer() { delete[] data; }
+
+  T* data;
+
+ private:
+  Buffer(const Buffer&);
+  Buffer& operator=(const Buffer&);
+};
+
+// Cached key of an element together with its original position
+template <typename Key, typename Index>
+struct KeyIndex {
+  Key key;
+  Index index;
+};
+
+// Keys from namespace std make std::swap visible through ADL, so a more
+// specialized overload is needed to resolve the call
+template <typename Key, typename Index>
+void swap(KeyIndex<Key, Index>& l, KeyIndex<Key, Index>& r) {
+  KeyIndex<Key, Index> t(NANOSORT_MOVE(l));
+  l = NANOSORT_MOVE(r);
+  r = NANOSORT_MOVE(t);
+}
+
+template <typename Key, typename Index, typename Compare>
+struct KeyIndexCompare {
+  Compare comp;
+
+  explicit KeyIndexCompare(Compare comp_) : comp(comp_) {}
+
+  bool operator()(const KeyIndex<Key, Index>& l,
+                  const KeyIndex<Key, Index>& r) const {
+    return comp(l.key, r.key);
+  }
+};
+
+// Move every element to its sorted position by walking permutation cycles;
+// keys[i].index is the original position of the element that belongs at i
+template <typename T, typename It, typename Key, typename Index>
+void apply_keys(It first, KeyIndex<Key, Index>* keys, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    if (keys[i].index == i) continue;
+
+    T tmp = NANOSORT_MOVE(first[i]);
+    size_t j = i;
+
+    while (keys[j].index != i) {
+      size_t k = keys[j].index;
+      first[j] = NANOSORT_MOVE(first[k]);
+      keys[j].index = Index(j);
+      j = k;
+    }
+
+    first[j] = NANOSORT_MOVE(tmp);
+    keys[j].index = Index(j);
+  }
+}
+
+template <typename T, typename Index, typename It, typename KeyFn,
+          typename Compare, typename Key>
+void sort_by_key(It first, It last, KeyFn keyfn, Compare comp, const Key&) {
+  typedef KeyIndex<Key, Index> Item;
+
+  size_t n = last - first;
+  Buffer<Item> keys(n);
+
+  for (size_t i = 0; i < n; ++i) {
+    keys.data[i].key = keyfn(first[i]);
+    keys.data[i].index = Index(i);
+  }
+
+  sort<Item>(keys.data, keys.data + n, n,
+             KeyIndexCompare<Key, Index, Compare>(comp));
+  apply_keys<T>(first, keys.data, n);
+}
+
+// Bytes of a string sorted with nanosort_strings; other string types need
+// data() and size() members, like std::string
+inline const unsigned char* string_data(const char* s) {
+  return reinterpret_cast<const unsigned char*>(s);
+}
+
+inline const unsigned char* string_data(char* s) {
+  return reinterpret_cast<const unsigned char*>(s);
+}
+
+template <typename S>
+const unsigned char* string_data(const S& s) {
+  return reinterpret_cast<const unsigned char*>(s.data());
+}
+
+inline size_t string_size(const char* s) { return strlen(s); }
+inline size_t string_size(char* s) { return strlen(s); }
+
+template <typename S>
+size_t string_size(const S& s) {
+  return size_t(s.size());
+}
+
+// Packs 7 bytes of a string at offset into the high bytes of an integer in
+// big-endian order, so that integer order matches memcmp order, and the number
+// of bytes present (up to 7) into the low byte; shorter strings are padded with
+// zeros and go before longer strings with the same bytes
+inline uint64_t string_chunk(const unsigned char* data, size_t size,
+                             size_t offset) {
+  const unsigned char* p = data + offset;
+  size_t n = size - offset;
+
+  if (n >= 8)
+    return (uint64_t(p[0]) << 56) | (uint64_t(p[1]) << 48) |
+           (uint64_t(p[2]) << 40) | (uint64_t(p[3]) << 32) |
+           (uint64_t(p[4]) << 24) | (uint64_t(p[5]) << 16) |
+           (uint64_t(p[6]) << 8) | 7;
+
+  uint64_t result = n < 7 ? n : 7;
+  for (size_t i = 0; i < n && i < 7; ++i)
+    result |= uint64_t(p[i]) << (56 - i * 8);
+  return result;
+}
+
+// Computes the size of a string once and returns its first chunk
+template <typename S>
+uint64_t string_head(const S& s, size_t* size) {
+  *size = string_size(s);
+  return string_chunk(string_data(s), *size, 0);
+}
+
+inline bool string_tail_less(const unsigned char* l, size_t ln,
+                             const unsigned char* r, size_t rn) {
+  int c = memcmp(l, r, ln < rn ? ln : rn);
+  return c != 0 ? c < 0 : ln < rn;
+}
+
+// Compares strings of elements that share offset bytes; keyfn may return
+// strings by value, so its results are only used within the expression that
+// computes them
+template <typename It, typename KeyFn>
+struct StringTailLess {
+  It first;
+  KeyFn keyfn;
+  const size_t* sizes;
+  size_t offset;
+
+  StringTailLess(It first_, KeyFn keyfn_, const size_t* sizes_,
+                 size_t offset_)
+      : first(first_), keyfn(keyfn_), sizes(sizes_), offset(offset_) {}
+
+  template <typename Index>
+  bool operator()(const KeyIndex<uint64_t, Index>& l,
+                  const KeyIndex<uint64_t, Index>& r) const {
+    return string_tail_less(string_data(keyfn(first[l.index])) + offset,
+                            sizes[l.index] - offset,
+                            string_data(keyfn(first[r.index])) + offset,
+                            sizes[r.index] - offset);
+  }
+};
+
+// Strings that share this many bytes are compared directly, which bounds the
+// recursion depth for long equal strings
+const size_t kStringCompareOffset = 7 * 8;
+
+// Sorts keys by chunks at offset, then sorts groups of equal chunks that don't
+// end the strings by the next chunk; this is a variant of multikey quicksort
+// (per Bentley and Sedgewick) that splits on 7 bytes at a time, and strings
+// are only read to load the next chunk
+template <typename It, typename KeyFn, typename Index>
+void sort_strings(It first, KeyFn keyfn, const size_t* sizes,
+                  KeyIndex<uint64_t, Index>* keys, size_t n, size_t offset) {
+  typedef KeyIndex<uint64_t, Index> Item;
+
+  if (offset >= kStringCompareOffset) {
+    sort<Item>(keys, keys + n, n,
+               StringTailLess<It, KeyFn>(first, keyfn, sizes, offset));
+    return;
+  }
+
+  sort<Item>(keys, keys + n, n, KeyIndexCompare<uint64_t, Index, Less>(Less()));
+
+  for (size_t i = 0; i < n;) {
+    size_t j = i + 1;
+    while (j < n && keys[j].key == keys[i].key) ++j;
+
+    if (j - i > 1 && (keys[i].key & 0xff) == 7) {
+      for (size_t k = i; k < j; ++k) {
+        size_t index = keys[k].index;
+        keys[k].key = string_chunk(string_data(keyfn(first[index])),
+                                   sizes[index], offset + 7);
+      }
+
+      sort_strings(first, keyfn, sizes, keys + i, j - i, offset + 7);
+    }
+
+    i = j;
+  }
+}
+
+// String sizes are cached next to the keys so that C strings are only scanned
+// with strlen once
+template <typename T, typename Index, typename It, typename KeyFn>
+void sort_strings_by_key(It first, It last, KeyFn keyfn) {
+  typedef KeyIndex<uint64_t, Index> Item;
+
+  size_t n = last - first;
+  Buffer<Item> keys(n);
+  Buffer<size_t> sizes(n);
+
+  for (size_t i = 0; i < n; ++i) {
+    keys.data[i].key = string_head(keyfn(first[i]), &sizes.data[i]);
+    keys.data[i].index = Index(i);
+  }
+
+  sort_strings(first, keyfn, sizes.data, keys.data, n, 0);
+  apply_keys<T>(first, keys.data, n);
+}
+
+// Compare indices by comparing the elements they refer to
+template <typename It, typename Compare>
+struct IndexCompare {
+  It first;
+  Compare comp;
+
+  IndexCompare(It first_, Compare comp_) : first(first_), comp(comp_) {}
+
+  template <typename Index>
+  bool operator()(Index l, Index r) const {
+    return comp(first[l], first[r]);
+  }
+};
+
+// Move every element to its position in perm by walking permutation cycles;
+// perm[i] is the original position of the element that belongs at i, and
+// visited positions are tracked in a bit array to keep perm intact
+template <typename T, typename It, typename PermIt>
+void apply_permutation(It first, PermIt perm, size_t n) {
+  size_t words = n / 32 + 1;
+  Buffer<uint32_t> visited(words);
+  memset(visited.data, 0, words * sizeof(uint32_t));
+
+  for (size_t i = 0; i < n; ++i) {
+    if (visited.data[i / 32] & (1u << (i % 32))) continue;
+    if (size_t(perm[i]) == i) continue;
+
+    T tmp = NANOSORT_MOVE(first[i]);
+    size_t j = i;
+
+    for (;;) {
+      size_t k = perm[j];
+      assert(k < n);
+
+      visited.data[j / 32] |= 1u << (j % 32);
+      if (k == i) break;
+
+      first[j] = NANOSORT_MOVE(first[k]);
+      j = k;
+    }
+
+    first[j] = NANOSORT_MOVE(tmp);
+  }
+}
+
+// Parallel arrays are sorted through an iterator over a list of columns that
+// dereferences to a proxy; the first column holds keys, and other columns are
+// moved together with it
+struct SoaEnd {
+  void advance(ptrdiff_t) {}
+  void swap_at(size_t, size_t) const {}
+  void swap_with(const SoaEnd&) const {}
+  void assign(const SoaEnd&) const {}
+};
+
+template <typename It, typename Next>
+struct SoaColumns {
+  typedef typename IteratorTraits<It>::value_type value_type;
+
+  It it;
+  Next next;
+
+  void advance(ptrdiff_t d) {
+    it += d;
+    next.advance(d);
+  }
+
+  void swap_at(size_t l, size_t r) const {
+    swap(it[l], it[r]);
+    next.swap_at(l, r);
+  }
+
+  void swap_with(const SoaColumns& o) const {
+    swap(*it, *o.it);
+    next.swap_with(o.next);
+  }
+
+  void assign(const SoaColumns& o) const {
+    *it = *o.it;
+    next.assign(o.next);
+  }
+};
+
+template <typename It, typename Next>
+SoaColumns<It, Next> soa_columns(It it, Next next) {
+  SoaColumns<It, Next> result = {it, next};
+  return result;
+}
+
+// Copy of one row of all columns
+template <typename Cols>
+struct SoaValue;
+
+template <>
+struct SoaValue<SoaEnd> {
+  explicit SoaValue(const SoaEnd&) {}
+  void store(const SoaEnd&) const {}
+};
+
+template <typename It, typename Next>
+struct SoaValue<SoaColumns<It, Next> > {
+  typename IteratorTraits<It>::value_type value;
+  SoaValue<Next> next;
+
+  explicit SoaValue(const SoaColumns<It, Next>& c)
+      : value(*c.it), next(c.next) {}
+
+  void store(const SoaColumns<It, Next>& c) const {
+    *c.it = value;
+    next.store(c.next);
+  }
+
+  const typename IteratorTraits<It>::value_type& key() const { return value; }
+};
+
+// Columns from namespace std make std::swap visible through ADL, so a more
+// specialized overload is needed to resolve the call
+template <typename Cols>
+void swap(SoaValue<Cols>& l, SoaValue<Cols>& r) {
+  SoaValue<Cols> t(l);
+  l = r;
+  r = t;
+}
+
+// Reference to one row; assignments write through to the columns
+template <typename Cols>
+struct SoaRef {
+  Cols cols;
+
+  explicit SoaRef(const Cols& c) : cols(c) {}
+  SoaRef(const SoaRef& o) : cols(o.cols) {}
+
+  operator SoaValue<Cols>() const { return SoaValue<Cols>(cols); }
+
+  SoaRef& operator=(const SoaRef& o) {
+    cols.assign(o.cols);
+    return *this;
+  }
+
+  SoaRef& operator=(const SoaValue<Cols>& v) {
+    v.store(cols);
+    return *this;
+  }
+
+  const typename Cols::value_type& key() const { return *cols.it; }
+};
+
+template <typename Cols>
+void swap(SoaRef<Cols> l, SoaRef<Cols> r) {
+  l.cols.swap_with(r.cols);
+}
+
+template <typename Cols>
+struct SoaIterator {
+  typedef SoaValue<Cols> value_type;
+
+  Cols cols;
+
+  SoaRef<Cols> operator*() const { return SoaRef<Cols>(cols); }
+
+  SoaRef<Cols> operator[](ptrdiff_t i) const { return *(*this + i); }
+
+  SoaIterator& operator+=(ptrdiff_t d) {
+    cols.advance(d);
+    return *this;
+  }
+
+  SoaIterator& operator-=(ptrdiff_t d) {
+    cols.advance(-d);
+    return *this;
+  }
+
+  SoaIterator& operator++() { return *this += 1; }
+  SoaIterator& operator--() { return *this -= 1; }
+
+  SoaIterator operator+(ptrdiff_t d) const {
+    SoaIterator result = *this;
+    return result += d;
+  }
+
+  SoaIterator operator-(ptrdiff_t d) const {
+    SoaIterator result = *this;
+    return result -= d;
+  }
+
+  ptrdiff_t operator-(const SoaIterator& o) const {
+    return cols.it - o.cols.it;
+  }
+
+  bool operator==(const SoaIterator& o) const { return cols.it == o.cols.it; }
+  bool operator!=(const SoaIterator& o) const { return cols.it != o.cols.it; }
+  bool operator<(const SoaIterator& o) const { return cols.it < o.cols.it; }
+};
+
+template <typename Cols>
+const void* element_address(SoaIterator<Cols> it) {
+  return &*it.cols.it;
+}
+
+// Compares rows by keys; other columns are never read
+template <typename Compare>
+struct SoaCompare {
+  Compare comp;
+
+  explicit SoaCompare(Compare comp_) : comp(comp_) {}
+
+  template <typename L, typename R>
+  bool operator()(const L& l, const R& r) const {
+    return comp(l.key(), r.key());
+  }
+};
+
+// Block partition refers to the pivot in the array, which proxies can't
+// provide, so rows are sorted by the partition that copies the pivot
+template <typename Cols>
+struct IsTrivial<SoaValue<Cols> > {
+  enum { value = true };
+};
+
+// Rows are partitioned by offsets, so each column is addressed with its own
+// stride and only keys are read
+template <typename Cols, typename Compare>
+SoaIterator<Cols> partition(const SoaValue<Cols>& pivot,
+                            SoaIterator<Cols> first, SoaIterator<Cols> last,
+                            SoaCompare<Compare> comp) {
+  size_t n = last - first, res = 0;
+
+  for (size_t i = 0; i < n; ++i) {
+    bool r = comp.comp(first.cols.it[i], pivot.key());
+    first.cols.swap_at(res, i);
+    res += r;
+  }
+
+  return first + res;
+}
+
+template <typename Cols, typename Compare>
+SoaIterator<Cols> partition_rev(const SoaValue<Cols>& pivot,
+                                SoaIterator<Cols> first,
+                                SoaIterator<Cols> last,
+                                SoaCompare<Compare> comp) {
+  size_t n = last - first, res = 0;
+
+  for (size_t i = 0; i < n; ++i) {
+    bool r = comp.comp(pivot.key(), first.cols.it[i]);
+    first.cols.swap_at(res, i);
+    res += !r;
+  }
+
+  return first + res;
+}
+
+template <typename It, typename Cols>
+void sort_soa(It first, It last, Cols cols) {
+  typedef SoaColumns<It, Cols> All;
+
+  size_t n = last - first;
+  SoaIterator<All> begin = {soa_columns(first, cols)};
+
+  sort<SoaValue<All> >(begin, begin + n, n, SoaCompare<Less>(Less()));
+}
+
+// Columns are added to the list one at a time; order of columns after the
+// keys doesn't matter
+template <typename It, typename Cols, typename C1>
+void sort_soa(It first, It last, Cols cols, C1 c1) {
+  sort_soa(first, last, soa_columns(c1, cols));
+}
+
+template <typename It, typename Cols, typename C1, typename C2>
+void sort_soa(It first, It last, Cols cols, C1 c1, C2 c2) {
+  sort_soa(first, last, soa_columns(c2, cols), c1);
+}
+
+template <typename It, typename Cols, typename C1, typename C2, typename C3>
+void sort_soa(It first, It last, Cols cols, C1 c1, C2 c2, C3 c3) {
+  sort_soa(first, last, soa_columns(c3, cols), c1, c2);
+}
+
+template <typename It, typename Cols, typename C1, typename C2, typename C3,
+          typename C4>
+void sort_soa(It first, It last, Cols cols, C1 c1, C2 c2, C3 c3, C4 c4) {
+  sort_soa(first, last, soa_columns(c4, cols), c1, c2, c3);
+}
+
+template <typename It, typename Cols, typename C1, typename C2, typename C3,
+          typename C4, typename C5>
+void sort_soa(It first, It last, Cols cols, C1 c1, C2 c2, C3 c3, C4 c4,
+              C5 c5) {
+  sort_soa(first, last, soa_columns(c5, cols), c1, c2, c3, c4);
+}
+
+template <typename It, typename Cols, typename C1, typename C2, typename C3,
+          typename C4, typename C5, typename C6>
+void sort_soa(It first, It last, Cols cols, C1 c1, C2 c2, C3 c3, C4 c4, C5 c5,
+              C6 c6) {
+  sort_soa(first, last, soa_columns(c6, cols), c1, c2, c3, c4, c5);
+}
+
+template <typename It>
+void reverse(It first, It last) {
+  while (last - first > 1) {
+    --last;
+    swap(*first, *last);
+    ++first;
+  }
+}
+
+// Merge sorted [first, mid) with sorted [mid, last) using a temporary copy of
+// the second range, which is expected to be short
+template <typename T, typename It, typename Compare>
+void merge_tail(It first, It mid, It last, Compare comp) {
+  size_t n = last - mid;
+  Buffer<T> tail(n);
+
+  for (size_t i = 0; i < n; ++i) tail.data[i] = NANOSORT_MOVE(mid[i]);
+
+  T* tend = tail.data + n;
+
+  while (tend != tail.data) {
+    if (mid != first && comp(tend[-1], mid[-1]))
+      *--last = NANOSORT_MOVE(*--mid);
+    else
+      *--last = NANOSORT_MOVE(*--tend);
+  }
+}
+
+// Insertion sort that gives up after moving more than limit elements
+template <typename T, typename It, typename Compare>
+bool insertion_sort_limit(It first, It start, It last, size_t limit,
+                          Compare comp) {
+  size_t moves = 0;
+
+  for (It it = start; it != last; ++it) {
+    if (!comp(*it, it[-1])) continue;
+
+    T tmp = NANOSORT_MOVE(*it);
+    It hole = it;
+
+    do {
+      *hole = NANOSORT_MOVE(hole[-1]);
+      --hole;
+    } while (hole != first && comp(tmp, hole[-1]) && ++moves <= limit);
+
+    *hole = NANOSORT_MOVE(tmp);
+
+    if (moves > limit) return false;
+  }
+
+  return true;
+}
+
+// Sort array in linear time if it's sorted, reverse sorted, sorted with a
+// short unsorted tail or has few inversions; returns false otherwise, in which
+// case the array is permuted but not sorted
+template <typename T, typename It, typename Compare>
+bool sort_presorted(It first, It last, Compare comp) {
+  size_t n = last - first;
+  if (n < 2) return true;
+
+  size_t desc = 1;
+  while (desc < n && !comp(first[desc - 1], first[desc])) desc++;
+
+  // Arrays of equal elements are also non-ascending but are already sorted
+  if (desc == n && comp(first[n - 1], first[0])) {
+    nanosort_detail::reverse(first, last);
+    return true;
+  }
+
+  size_t run = 1;
+  while (run < n && !comp(first[run], first[run - 1])) run++;
+
+  if (run == n) return true;
+
+  // Short tails, such as new records appended to a sorted array, are sorted
+  // separately and merged
+  if (n - run <= n / 16) {
+    sort<T>(first + run, last, n - run, comp);
+    merge_tail<T>(first, first + run, last, comp);
+    return true;
+  }
+
+  return insertion_sort_limit<T>(first, first + run, last, n / 8, comp);
+}
+
+// Merge of 2-4 non-empty runs that selects the smallest head using masks, since
+// compilers tend to emit branches for ternaries; ties go to the earlier run.
+// Once a run is exhausted it's removed and the remaining runs are merged with a
+// smaller k
+template <typename It, typename OutIt, typename Compare>
+OutIt merge_small(It* first, It* last, size_t k, OutIt out, Compare comp) {
+  while (k > 2) {
+    size_t w;
+
+    if (k == 4) {
+      for (;;) {
+        size_t x = comp(*first[1], *first[0]);
+        size_t y = 2 + comp(*first[3], *first[2]);
+        w = x ^ ((x ^ y) & (0 - size_t(comp(*first[y], *first[x]))));
+
+        *out = *first[w];
+        ++out;
+        if (++first[w] == last[w]) break;
+      }
+    } else {
+      for (;;) {
+        size_t x = comp(*first[1], *first[0]);
+        w = x ^ ((x ^ 2) & (0 - size_t(comp(*first[2], *first[x]))));
+
+        *out = *first[w];
+        ++out;
+        if (++first[w] == last[w]) break;
+      }
+    }
+
+    for (size_t i = w; i + 1 < k; ++i) {
+      first[i] = first[i + 1];
+      last[i] = last[i + 1];
+    }
+
+    k--;
+  }
+
+  It l = first[0], lend = last[0];
+  It r = k == 2 ? first[1] : lend, rend = k == 2 ? last[1] : lend;
+
+  while (l != lend && r != rend) {
+    bool c = comp(*r, *l);
+    *out = c ? *r : *l;
+    ++out;
+    r += c;
+    l += !c;
+  }
+
+  while (l != lend) *out = *l, ++out, ++l;
+  while (r != rend) *out = *r, ++out, ++r;
+
+  return out;
+}
+
+// Returns the run that goes first out of runs a and b; exhausted runs lose and
+// ties go to the earlier run, which only needs one comparison
+template <typename It, typename Compare>
+inline size_t merge_winner(It* first, const unsigned char* done, size_t a,
+                           size_t b, Compare comp) {
+  size_t lo = a ^ ((a ^ b) & (0 - size_t(b < a)));
+  size_t hi = a ^ b ^ lo;
+
+  bool c = comp(*first[hi], *first[lo]);
+  bool h = done[lo] | (!done[hi] & c);
+
+  return lo ^ ((lo ^ hi) & (0 - size_t(h)));
+}
+
+// Merge of k non-empty runs using a loser tree: node p in [1, k) stores the run
+// that lost the match at that node, and the leaf for run i is node k + i, so
+// each element takes log2(k) comparisons on the path from its leaf to the root.
+// Exhausted runs point to their last element so that the tree can keep
+// comparing them without branches
+template <typename It, typename OutIt, typename Compare>
+OutIt merge_tree(It* first, It* last, size_t k, OutIt out, Compare comp) {
+  Buffer<size_t> tree(k);
+  Buffer<size_t> winner(k * 2);
+  Buffer<unsigned char> done(k);
+
+  size_t count = 0;
+
+  for (size_t i = 0; i < k; ++i) {
+    count += last[i] - first[i];
+    done.data[i] = 0;
+    winner.data[k + i] = i;
+  }
+
+  for (size_t p = k - 1; p > 0; --p) {
+    size_t a = winner.data[p * 2], b = winner.data[p * 2 + 1];
+
+    winner.data[p] = merge_winner(first, done.data, a, b, comp);
+    tree.data[p] = a ^ b ^ winner.data[p];
+  }
+
+  size_t w = winner.data[1];
+
+  for (size_t i = 0; i < count; ++i) {
+    *out = *first[w];
+    ++out;
+
+    if (NANOSORT_UNLIKELY(++first[w] == last[w])) {
+      done.data[w] = 1;
+      --first[w];
+    }
+
+    for (size_t p = (k + w) >> 1; p > 0; p >>= 1) {
+      size_t l = tree.data[p];
+      size_t r = merge_winner(first, done.data, l, w, comp);
+
+      tree.data[p] = l ^ w ^ r;
+      w = r;
+    }
+  }
+
+  return out;
+}
+
+// Samplesort distributes elements into this many buckets at most, plus the same
+// number of buckets for elements equal to splitters
+const size_t kSampleSortBuckets = 256;
+
+// Elements are moved between buffers and the array in blocks of this size
+const size_t kSampleSortBlockBytes = 1024;
+
+// Subarrays below this size are sorted by sort instead of another level
+const size_t kSampleSortBaseBytes = 1 << 20;
+
+// Number of samplesort levels before falling back to sort; each level divides
+// the array into up to 256 buckets, so this is never reached for good splitters
+const size_t kSampleSortLevels = 8;
+
+// Elements are classified in groups of this size to interleave tree descents
+const size_t kSampleSortGroup = 8;
+
+template <typename T>
+struct SampleSortSize {
+  enum {
+    block = sizeof(T) < kSampleSortBlockBytes
+                ? kSampleSortBlockBytes / sizeof(T)
+                : 1,
+    base = sizeof(T) < kSampleSortBaseBytes / 1024
+               ? kSampleSortBaseBytes / sizeof(T)
+               : 1024
+  };
+};
+
+// Scratch memory for samplesort which is reused across levels; all buffers
+// have a fixed size that doesn't depend on the array size
+template <typename T>
+struct SampleSortState {
+  Buffer<T> buffers;
+  Buffer<T> swap;
+  Buffer<T> overflow;
+  Buffer<T> tree;
+  Buffer<T> lower;
+  Buffer<size_t> fill;
+  Buffer<size_t> blocks;
+  Buffer<size_t> write;
+  Buffer<size_t> read;
+
+  SampleSortState()
+      : buffers(kSampleSortBuckets * 2 * SampleSortSize<T>::block),
+        swap(2 * SampleSortSize<T>::block),
+        overflow(SampleSortSize<T>::block),
+        tree(kSampleSortBuckets),
+        lower(kSampleSortBuckets),
+        fill(kSampleSortBuckets * 2),
+        blocks(kSampleSortBuckets * 2),
+        write(kSampleSortBuckets * 2),
+        read(kSampleSortBuckets * 2) {}
+};
+
+// Find bucket of x by descending the splitter tree; tree node i has children 2i
+// and 2i+1, and leaves are buckets. Bucket i has elements that are not less
+// than lower[i] and less than lower[i+1]; with equality buckets, it's split
+// into bucket 2i with elements equal to lower[i] and bucket 2i+1 with the rest
+template <bool Equal, typename T, typename Compare>
+size_t sample_bucket(const T* tree, const T* lower, size_t log_k, const T& x,
+                     Compare comp) {
+  size_t b = 1;
+  for (size_t l = 0; l < log_k; ++l) b = 2 * b + !comp(x, tree[b]);
+
+  b -= size_t(1) << log_k;
+
+  return Equal ? 2 * b + 1 - ((b != 0) & !comp(lower[b], x)) : b;
+}
+
+// Same as sample_bucket for a group of 8 elements; tree descent doesn't have
+// branches, so interleaving the descents hides the latency of each level
+template <bool Equal, typename T, typename It, typename Compare>
+void sample_buckets(const T* tree, const T* lower, size_t log_k, It first,
+                    size_t* result, Compare comp) {
+  size_t b0 = 1, b1 = 1, b2 = 1, b3 = 1, b4 = 1, b5 = 1, b6 = 1, b7 = 1;
+
+  for (size_t l = 0; l < log_k; ++l) {
+    b0 = 2 * b0 + !comp(first[0], tree[b0]);
+    b1 = 2 * b1 + !comp(first[1], tree[b1]);
+    b2 = 2 * b2 + !comp(first[2], tree[b2]);
+    b3 = 2 * b3 + !comp(first[3], tree[b3]);
+    b4 = 2 * b4 + !comp(first[4], tree[b4]);
+    b5 = 2 * b5 + !comp(first[5], tree[b5]);
+    b6 = 2 * b6 + !comp(first[6], tree[b6]);
+    b7 = 2 * b7 + !comp(first[7], tree[b7]);
+  }
+
+  size_t b[8] = {b0, b1, b2, b3, b4, b5, b6, b7};
+
+  for (size_t j = 0; j < 8; ++j) {
+    size_t r = b[j] - (size_t(1) << log_k);
+
+    result[j] =
+        Equal ? 2 * r + 1 - ((r != 0) & !comp(lower[r], first[j])) : r;
+  }
+}
+
+template <typename T, typename It, typename OutIt>
+void move_block(It first, size_t count, OutIt out) {
+  for (size_t i = 0; i < count; ++i) out[i] = NANOSORT_MOVE(first[i]);
+}
+
+// Distributes elements into buckets: each element is appended to the buffer of
+// its bucket, and full buffers are written back to the array as blocks; returns
+// the number of elements in blocks, which are at the start of the array
+template <bool Equal, typename T, typename It, typename Compare>
+size_t sample_classify(SampleSortState<T>& state, It first, It last,
+                       size_t log_k, Compare comp) {
+  const size_t block = SampleSortSize<T>::block;
+  size_t n = last - first;
+  size_t buckets = (Equal ? 2 : 1) << log_k;
+
+  T* buffers = state.buffers.data;
+  size_t* fill = state.fill.data;
+  size_t* blocks = state.blocks.data;
+
+  for (size_t b = 0; b < buckets; ++b) fill[b] = blocks[b] = 0;
+
+  size_t write = 0;
+  size_t group[kSampleSortGroup];
+
+  for (size_t i = 0; i < n; i += kSampleSortGroup) {
+    size_t count = n - i < kSampleSortGroup ? n - i : kSampleSortGroup;
+
+    if (count == kSampleSortGroup)
+      sample_buckets<Equal>(state.tree.data, state.lower.data, log_k,
+                            first + i, group, comp);
+    else
+      for (size_t j = 0; j < count; ++j)
+        group[j] = sample_bucket<Equal>(state.tree.data, state.lower.data,
+                                        log_k, first[i + j], comp);
+
+    // Every written block consists of elements that were already read
+    for (size_t j = 0; j < count; ++j) {
+      size_t b = group[j];
+      T* buffer = buffers + b * block;
+
+      buffer[fill[b]++] = NANOSORT_MOVE(first[i + j]);
+
+      if (fill[b] == block) {
+        move_block<T>(buffer, block, first + write);
+        write += block;
+        fill[b] = 0;
+        blocks[b]++;
+      }
+    }
+  }
+
+  return write;
+}
+
+// Chooses splitters from a sample of the array and builds the splitter tree;
+// returns log2 of the number of buckets, which is doubled when the sample has
+// equal splitters and equality buckets are used
+template <typename T, typename It, typename Compare>
+size_t sample_splitters(SampleSortState<T>& state, It first, It last,
+                        bool& equal, Compare comp) {
+  size_t n = last - first;
+
+  size_t log_k = 1;
+  while ((size_t(1) << log_k) < kSampleSortBuckets &&
+         n >> log_k > SampleSortSize<T>::base)
+    log_k++;
+
+  size_t k = size_t(1) << log_k;
+
+  // Oversampling makes bucket sizes more even for larger arrays
+  size_t log_n = 0;
+  while (n >> log_n > 1) log_n++;
+
+  size_t step = log_n / 4 < 1 ? 1 : log_n / 4;
+  size_t sample = k * step - 1;
+
+  // Move random elements to the start of the array to form the sample; low
+  // bits of the generator have short periods so high bits are mixed in
+  size_t seed = n;
+  for (size_t i = 0; i < sample; ++i) {
+    seed = seed * 1103515245 + 12345;
+    size_t r = seed ^ (seed >> (sizeof(size_t) * 4));
+    swap(first[i], first[i + r % (n - i)]);
+  }
+
+  sort<T>(first, first + sample, sample, comp);
+
+  // Splitters that are equal to the previous splitter are removed, and the
+  // rest of the tree is filled with the last splitter
+  T* lower = state.lower.data;
+  size_t m = 0;
+  equal = false;
+
+  for (size_t i = 1; i < k; ++i) {
+    const T& x = first[i * step - 1];
+
+    if (m == 0 || comp(lower[m], x))
+      lower[++m] = x;
+    else
+      equal = true;
+  }
+
+  while ((k >> 1) > m) k >>= 1, log_k--;
+
+  for (size_t i = m + 1; i < k; ++i) lower[i] = lower[m];
+  lower[0] = lower[1];
+
+  // Node i at level l of the tree gets the splitter in the middle of its range
+  for (size_t l = 0; l < log_k; ++l)
+    for (size_t i = size_t(1) << l; i < size_t(2) << l; ++i)
+      state.tree.data[i] =
+          lower[(2 * (i - (size_t(1) << l)) + 1) * (k >> (l + 1))];
+
+  return log_k;
+}
+
+template <typename T, typename It, typename Compare>
+size_t sample_classify(SampleSortState<T>& state, It first, It last,
+                       size_t log_k, bool equal, Compare comp) {
+  return equal ? sample_classify<true>(state, first, last, log_k, comp)
+               : sample_classify<false>(state, first, last, log_k, comp);
+}
+
+// Moves blocks so that blocks of each bucket follow each other; bucket b gets
+// the blocks in [start, start + blocks * block), where start is the bucket
+// start rounded up to a block. Blocks in [write[b], read[b]) are not yet
+// processed, and blocks are always swapped into the first unprocessed slot of
+// their bucket. At most one block crosses the end of the array and is kept in
+// the overflow buffer; returns its position or n if there is no such block
+template <bool Equal, typename T, typename It, typename Compare>
+size_t sample_permute(SampleSortState<T>& state, It first, size_t n,
+                      size_t log_k, size_t buckets, Compare comp) {
+  const size_t block = SampleSortSize<T>::block;
+
+  size_t* write = state.write.data;
+  size_t* read = state.read.data;
+
+  T* current = state.swap.data;
+  T* next = state.swap.data + block;
+
+  size_t overflow = n;
+
+  for (size_t b = 0; b < buckets; ++b) {
+    while (read[b] > write[b]) {
+      read[b] -= block;
+      move_block<T>(first + read[b], block, current);
+
+      for (;;) {
+        size_t dest = sample_bucket<Equal>(state.tree.data, state.lower.data,
+                                           log_k, current[0], comp);
+        size_t pos = write[dest];
+        write[dest] += block;
+
+        if (pos < read[dest]) {
+          move_block<T>(first + pos, block, next);
+          move_block<T>(current, block, first + pos);
+
+          T* t = current;
+          current = next;
+          next = t;
+        } else {
+          if (pos + block > n) {
+            move_block<T>(current, block, state.overflow.data);
+            overflow = pos;
+          } else {
+            move_block<T>(current, block, first + pos);
+          }
+          break;
+        }
+      }
+    }
+  }
+
+  return overflow;
+}
+
+// Moves blocks at the end of the array to gaps at the end of stripes, where
+// stripe i starts at offset stripes[i], is a multiple of the block size and
+// has full[i] elements in blocks at its start; calls move(src, dest) for each
+// block and returns the end of blocks, which is the total of full[i]
+template <typename Move>
+size_t sample_compact(const size_t* stripes, const size_t* full, size_t count,
+                      size_t block, Move move) {
+  size_t full_end = 0;
+  for (size_t i = 0; i < count; ++i) full_end += full[i];
+
+  size_t i = 0, gap = full[0];
+  size_t j = count - 1, top = stripes[j] + full[j];
+
+  for (;;) {
+    while (i + 1 < count && gap == stripes[i + 1]) {
+      ++i;
+      gap = stripes[i] + full[i];
+    }
+
+    if (gap >= full_end) break;
+
+    while (top == stripes[j]) {
+      --j;
+      top = stripes[j] + full[j];
+    }
+
+    top -= block;
+    move(top, gap);
+    gap += block;
+  }
+
+  return full_end;
+}
+
+template <typename T, typename It>
+struct BlockMove {
+  It first;
+
+  void operator()(size_t src, size_t dest) const {
+    move_block<T>(first + src, SampleSortSize<T>::block, first + dest);
+  }
+};
+
+// Computes bucket bounds from bucket sizes of count stripes, which use
+// states[i], and sets up write and read pointers of states[0] for permutation
+template <typename T>
+void sample_pointers(SampleSortState<T>* const* states, size_t count,
+                     size_t buckets, size_t full_end, size_t* bounds) {
+  const size_t block = SampleSortSize<T>::block;
+
+  bounds[0] = 0;
+  for (size_t b = 0; b < buckets; ++b) {
+    size_t size = 0;
+    for (size_t s = 0; s < count; ++s)
+      size += states[s]->blocks.data[b] * block + states[s]->fill.data[b];
+
+    bounds[b + 1] = bounds[b] + size;
+  }
+
+  for (size_t b = 0; b < buckets; ++b) {
+    size_t start = (bounds[b] + block - 1) / block * block;
+    size_t end = (bounds[b + 1] + block - 1) / block * block;
+
+    states[0]->write.data[b] = start;
+    states[0]->read.data[b] = end < full_end   ? end
+                              : full_end < start ? start
+                                                 : full_end;
+  }
+}
+
+// Number of elements written past the end of bucket b by the permutation; they
+// are in the first block of the next bucket
+template <typename T>
+size_t sample_extra(const SampleSortState<T>& state, const size_t* bounds,
+                    size_t b) {
+  const size_t block = SampleSortSize<T>::block;
+
+  size_t begin = bounds[b], end = bounds[b + 1];
+  size_t start = (begin + block - 1) / block * block;
+  size_t written = state.write.data[b];
+
+  return written > start && written > end ? written - end : 0;
+}
+
+// Moves elements written past the end of bucket b to saved, so that the next
+// bucket can be filled before bucket b; the overflow block is logically at
+// [overflow, overflow + block) and its part past the end is in the buffer
+template <typename T, typename It>
+void sample_save(const SampleSortState<T>& state, It first, size_t n,
+                 size_t overflow, const size_t* bounds, size_t b, T* saved) {
+  size_t extra = sample_extra(state, bounds, b);
+
+  for (size_t e = 0; e < extra; ++e) {
+    size_t src = bounds[b + 1] + e;
+
+    saved[e] = src < n ? NANOSORT_MOVE(first[src])
+                       : NANOSORT_MOVE(state.overflow.data[src - overflow]);
+  }
+}
+
+// Bucket b is missing elements at the start, which belong to the previous
+// bucket, and possibly at the end; these are filled with elements after its
+// end, which are from blocks that didn't fit into it, and with elements from
+// the buffers of count stripes. Elements after the end are taken from saved if
+// it's given, and otherwise the previous bucket must be filled first so that
+// the start is free
+template <typename T, typename It>
+void sample_fill(SampleSortState<T>* const* states, size_t count, It first,
+                 size_t n, size_t overflow, const size_t* bounds, size_t b,
+                 T* saved) {
+  const size_t block = SampleSortSize<T>::block;
+  const SampleSortState<T>& state = *states[0];
+
+  size_t begin = bounds[b], end = bounds[b + 1];
+  size_t start = (begin + block - 1) / block * block;
+  size_t written = state.write.data[b];
+
+  size_t extra = sample_extra(state, bounds, b);
+  size_t head = (start < end ? start : end) - begin;
+  size_t dest = 0;
+
+  for (size_t e = 0; e < extra; ++e, ++dest) {
+    size_t src = end + e;
+
+    first[dest < head ? begin + dest : written + (dest - head)] =
+        saved       ? NANOSORT_MOVE(saved[e])
+        : src < n   ? NANOSORT_MOVE(first[src])
+                    : NANOSORT_MOVE(state.overflow.data[src - overflow]);
+  }
+
+  for (size_t s = 0; s < count; ++s) {
+    T* buffer = states[s]->buffers.data + b * block;
+    size_t filled = states[s]->fill.data[b];
+
+    for (size_t e = 0; e < filled; ++e, ++dest)
+      first[dest < head ? begin + dest : written + (dest - head)] =
+          NANOSORT_MOVE(buffer[e]);
+  }
+}
+
+// Rearranges the array into buckets after classification of count stripes,
+// where stripe i starts at offset stripes[i], is a multiple of the block size
+// and has full[i] elements in blocks at its start; stripe i uses states[i],
+// and the splitter tree and the swap buffers are taken from states[0].
+// Bucket b ends up in [bounds[b], bounds[b+1])
+template <typename T, typename It, typename Compare>
+void sample_distribute(SampleSortState<T>* const* states,
+                       const size_t* stripes, const size_t* full, size_t count,
+                       It first, It last, size_t log_k, bool equal,
+                       size_t* bounds, Compare comp) {
+  const size_t block = SampleSortSize<T>::block;
+  size_t n = last - first;
+  size_t buckets = (equal ? 2 : 1) << log_k;
+
+  SampleSortState<T>& state = *states[0];
+
+  BlockMove<T, It> move = {first};
+  size_t full_end = sample_compact(stripes, full, count, block, move);
+
+  sample_pointers(states, count, buckets, full_end, bounds);
+
+  size_t overflow =
+      equal ? sample_permute<true>(state, first, n, log_k, buckets, comp)
+            : sample_permute<false>(state, first, n, log_k, buckets, comp);
+
+  // The part of the overflow block inside the array is copied there, and the
+  // rest is read from the buffer
+  if (overflow < n)
+    move_block<T>(state.overflow.data, n - overflow, first + overflow);
+
+  for (size_t b = 0; b < buckets; ++b)
+    sample_fill(states, count, first, n, overflow, bounds, b,
+                static_cast<T*>(0));
+}
+
+// Splits array into buckets in place using a sample of the array to choose
+// splitters; bucket b ends up in [bounds[b], bounds[b+1]) and the number of
+// buckets is returned. When the sample has equal splitters, every other bucket
+// has elements equal to a splitter and doesn't need to be sorted
+template <typename T, typename It, typename Compare>
+size_t sample_partition(SampleSortState<T>& state, It first, It last,
+                        size_t* bounds, bool& equal, Compare comp) {
+  size_t log_k = sample_splitters(state, first, last, equal, comp);
+
+  size_t stripes[2] = {0, size_t(last - first)};
+  size_t full = sample_classify(state, first, last, log_k, equal, comp);
+
+  SampleSortState<T>* states = &state;
+  sample_distribute(&states, stripes, &full, 1, first, last, log_k, equal,
+                    bounds, comp);
+
+  return (equal ? 2 : 1) << log_k;
+}
+
+template <typename T, typename It, typename Compare>
+void samplesort(SampleSortState<T>& state, It first, It last, size_t levels,
+                Compare comp) {
+  size_t n = last - first;
+
+  if (n <= SampleSortSize<T>::base || levels == 0) {
+    sort<T>(first, last, n, comp);
+    return;
+  }
+
+  size_t bounds[kSampleSortBuckets * 2 + 1];
+  bool equal;
+  size_t buckets = sample_partition(state, first, last, bounds, equal, comp);
+
+  // Buckets of elements equal to a splitter are already sorted
+  for (size_t b = equal; b < buckets; b += 1 + equal)
+    samplesort<T>(state, first + bounds[b], first + bounds[b + 1], levels - 1,
+                  comp);
+}
+
+}  // namespace nanosort_detail
+
+template <typename It, typename Compare>
+NANOSORT_CONSTEXPR void nanosort(It first, It last, Compare comp) {
+  typedef typename nanosort_detail::IteratorTraits<It>::value_type T;
+  nanosort_detail::sort<T>(first, last, last - first, comp);
+}
+
+template <typename It>
+NANOSORT_CONSTEXPR void nanosort(It first, It last) {
+  nanosort_detail::sort_less(first, last);
+}
+
+// Same as nanosort, but adds statistics about the sort to stats, which should be
+// zero-initialized before the first call; comparisons are counted through a
+// wrapper for comp, so this doesn't use SIMD code paths
+template <typename It, typename Compare>
+void nanosort_instrumented(It first, It last, Compare comp,
+                           nanosort_stats& stats) {
+  typedef typename nanosort_detail::IteratorTraits<It>::value_type T;
+
+  nanosort_detail::CountingCompare<Compare> ccomp = {comp, &stats.comparisons};
+  nanosort_detail::StatsRecorder recorder = {&stats, 0};
+
+  nanosort_detail::sort<T>(first, last, last - first, ccomp, recorder);
+}
+
+template <typename It>
+void nanosort_instrumented(It first, It last, nanosort_stats& stats) {
+  nanosort_instrumented(first, last, nanosort_detail::Less(), stats);
+}
+
+// Sorts count segments of data, where segment i is the range between
+// data+offsets[i] and data+offsets[i+1]
+template <typename It, typename OffsetIt, typename Compare>
+void nanosort_segmented(It data, OffsetIt offsets, size_t count,
+                        Compare comp) {
+  typedef typename nanosort_detail::IteratorTraits<It>::value_type T;
+  nanosort_detail::sort_segments<T>(data, offsets, count, comp);
+}
+
+template <typename It, typename OffsetIt>
+void nanosort_segmented(It data, OffsetIt offsets, size_t count) {
+  nanosort_segmented(data, offsets, count, nanosort_detail::Less());
+}
+
+// Stable sort; scratch must point to a buffer with at least last-first
+// elements, and no memory is allocated
+template <typename It, typename Compare, typename ScratchIt>
+void nanosort_stable(It first, It last, Compare comp, ScratchIt scratch) {
+  typedef typename nanosort_detail::IteratorTraits<It>::value_type T;
+  nanosort_detail::merge_sort<T>(first, last, scratch, comp);
+}
+
+template <typename It, typename ScratchIt>
+void nanosort_stable(It first, It last, ScratchIt scratch) {
+  nanosort_stable(first, last, nanosort_detail::Less(), scratch);
+}
+
+// Sorts sorted, reverse sorted and almost sorted arrays in linear time, which
+// costs a linear scan for other arrays; may allocate memory for a copy of up
+// to 1/16 of the array
+template <typename It, typename Compare>
+void nanosort_adaptive(It first, It last, Compare comp) {
+  typedef typename nanosort_detail::IteratorTraits<It>::value_type T;
+  if (nanosort_detail::sort_presorted<T>(first, last, comp)) return;
+
+  nanosort_detail::sort<T>(first, last, last - first, comp);
+}
+
+template <typename It>
+void nanosort_adaptive(It first, It last) {
+  nanosort_adaptive(first, last, nanosort_detail::Less());
+}
+
+// Sorts elements and keeps one element from every group of equal elements,
+// same as std::sort followed by std::unique; returns the end of the unique
+// elements, and elements after it are left in unspecified state.
+// Equal elements are dropped during the sort, so inputs with many duplicates
+// take less time than sorting them
+template <typename It, typename Compare>
+It nanosort_unique(It first, It last, Compare comp) {
+  typedef typename nanosort_detail::IteratorTraits<It>::value_type T;
+  return nanosort_detail::sort_unique<T>(first, last, first, last - first,
+                                         comp, static_cast<const T*>(0));
+}
+
+template <typename It>
+It nanosort_unique(It first, It last) {
+  return nanosort_unique(first, last, nanosort_detail::Less());
+}
+
+// Rearranges elements so that nth is the element that would be at this position
+// in a sorted array; elements before nth are not greater than it
+template <typename It, typename Compare>
+void nanosort_select(It first, It nth, It last, Compare comp) {
+  typedef typename nanosort_detail::IteratorTraits<It>::value_type T;
+  if (nth == last) return;
+
+  nanosort_detail::select_nth<T>(first, nth, last, last - first, comp);
+}
+
+template <typename It>
+void nanosort_select(It first, It nth, It last) {
+  nanosort_select(first, nth, last, nanosort_detail::Less());
+}
+
+// Sorts the smallest middle-first elements into [first, middle); when there are
+// very few of them, a heap is used which is slower for some inputs
+template <typename It, typename Compare>
+void nanosort_partial(It first, It middle, It last, Compare comp) {
+  typedef typename nanosort_detail::IteratorTraits<It>::value_type T;
+  if (middle == first) return;
+
+  if (size_t(middle - first) * 1024 <= size_t(last - first)) {
+    nanosort_detail::partial_heap(first, middle, last, comp);
+    return;
+  }
+
+  if (middle != last)
+    nanosort_detail::select_nth<T>(first, middle, last, last - first, comp);
+
+  nanosort_detail::sort<T>(first, middle, middle - first, comp);
+}
+
+template <typename It>
+void nanosort_partial(It first, It middle, It last) {
+  nanosort_partial(first, middle, last, nanosort_detail::Less());
+}
+
+// Places elements at positions ranks[0..count-1], which must be in ascending
+// order, as nanosort_select would, using a single partitioning pass
+template <typename It, typename RankIt, typename Compare>
+void nanosort_quantiles(It first, It last, RankIt ranks, size_t count,
+                        Compare comp) {
+  typedef typename nanosort_detail::IteratorTraits<It>::value_type T;
+
+  for (size_t i = 0; i < count; ++i) {
+    assert(size_t(ranks[i]) < size_t(last - first));
+    assert(i == 0 || !(ranks[i] < ranks[i - 1]));
+  }
+
+  nanosort_detail::select_ranks<T>(first, first, last, ranks, ranks + count,
+                                   last - first, comp);
+}
+
+template <typename It, typename RankIt>
+void nanosort_quantiles(It first, It last, RankIt ranks, size_t count) {
+  nanosort_quantiles(first, last, ranks, count, nanosort_detail::Less());
+}
+
+template <typename It, typename KeyFn>
+void nanosort_radix(It first, It last, KeyFn keyfn) {
+  typedef typename nanosort_detail::IteratorTraits<It>::value_type T;
+  if (first == last) return;
+  nanosort_detail::radix_sort_key<T>(first, last, keyfn, keyfn(*first));
+}
+
+template <typename It>
+void nanosort_radix(It first, It last) {
+  nanosort_radix(first, last, nanosort_detail::Identity());
+}
+
+// Scratch must point to a buffer with at least last-first elements
+template <typename It, typename KeyFn, typename ScratchIt>
+void nanosort_radix(It first, It last, KeyFn keyfn, ScratchIt scratch) {
+  if (first == last) return;
+  nanosort_detail::radix_sort_key(first, last, scratch, keyfn, keyfn(*first));
+}
+
+// Computes each key once and sorts elements by keys using comp; allocates
+// memory for keys and 32-bit or 64-bit indices
+template <typename It, typename KeyFn, typename Compare>
+void nanosort_by_key(It first, It last, KeyFn keyfn, Compare comp) {
+  typedef typename nanosort_detail::IteratorTraits<It>::value_type T;
+  if (first == last) return;
+
+  if (size_t(last - first) <= 0xffffffffu)
+    nanosort_detail::sort_by_key<T, uint32_t>(first, last, keyfn, comp,
+                                              keyfn(*first));
+  else
+    nanosort_detail::sort_by_key<T, size_t>(first, last, keyfn, comp,
+                                            keyfn(*first));
+}
+
+template <typename It, typename KeyFn>
+void nanosort_by_key(It first, It last, KeyFn keyfn) {
+  nanosort_by_key(first, last, keyfn, nanosort_detail::Less());
+}
+
+// Sorts strings in lexicographical order of bytes compared as unsigned chars,
+// which matches strcmp and std::string; works for C strings and for types with
+// data() and size() members. keyfn can return a C string or a string; strings
+// returned by value are copied every time they are read, so references to
+// strings stored in the elements are faster. Caches 7 bytes and the length of
+// each string in an integer key, so strings are only read when keys are equal;
+// allocates memory for keys, indices and sizes, and moves elements in place
+template <typename It, typename KeyFn>
+void nanosort_strings(It first, It last, KeyFn keyfn) {
+  typedef typename nanosort_detail::IteratorTraits<It>::value_type T;
+
+  if (size_t(last - first) <= 0xffffffffu)
+    nanosort_detail::sort_strings_by_key<T, uint32_t>(first, last, keyfn);
+  else
+    nanosort_detail::sort_strings_by_key<T, size_t>(first, last, keyfn);
+}
+
+template <typename It>
+void nanosort_strings(It first, It last) {
+  nanosort_strings(first, last, nanosort_detail::Identity());
+}
+
+// Writes indices of elements in sorted order to out without moving elements;
+// index type of out must be able to represent last-first-1, so 32-bit
+// indices can be used when the array has fewer than 2^32 elements
+template <typename It, typename Compare, typename OutIt>
+void nanosort_indices(It first, It last, Compare comp, OutIt out) {
+  typedef typename nanosort_detail::IteratorTraits<OutIt>::value_type Index;
+
+  size_t n = last - first;
+  assert(n == 0 || size_t(Index(n - 1)) == n - 1);
+
+  for (size_t i = 0; i < n; ++i) out[i] = Index(i);
+
+  nanosort_detail::sort<Index>(
+      out, out + n, n, nanosort_detail::IndexCompare<It, Compare>(first, comp));
+}
+
+template <typename It, typename OutIt>
+void nanosort_indices(It first, It last, OutIt out) {
+  nanosort_indices(first, last, nanosort_detail::Less(), out);
+}
+
+// Reorders elements so that first[i] receives the element previously at
+// first[perm[i]]; perm is not modified and can be applied to other arrays
+template <typename It, typename PermIt>
+void nanosort_apply_permutation(It first, It last, PermIt perm) {
+  typedef typename nanosort_detail::IteratorTraits<It>::value_type T;
+  nanosort_detail::apply_permutation<T>(first, perm, last - first);
+}
+
+// Sorts parallel arrays by keys in [first, last) using operator<; elements of
+// columns c1..c6 are moved together with their keys and are never compared
+template <typename It, typename C1>
+void nanosort_soa(It first, It last, C1 c1) {
+  nanosort_detail::sort_soa(first, last, nanosort_detail::SoaEnd(), c1);
+}
+
+template <typename It, typename C1, typename C2>
+void nanosort_soa(It first, It last, C1 c1, C2 c2) {
+  nanosort_detail::sort_soa(first, last, nanosort_detail::SoaEnd(), c1, c2);
+}
+
+template <typename It, typename C1, typename C2, typename C3>
+void nanosort_soa(It first, It last, C1 c1, C2 c2, C3 c3) {
+  nanosort_detail::sort_soa(first, last, nanosort_detail::SoaEnd(), c1, c2,
+                            c3);
+}
+
+template <typename It, typename C1, typename C2, typename C3, typename C4>
+void nanosort_soa(It first, It last, C1 c1, C2 c2, C3 c3, C4 c4) {
+  nanosort_detail::sort_soa(first, last, nanosort_detail::SoaEnd(), c1, c2,
+                            c3, c4);
+}
+
+template <typename It, typename C1, typename C2, typename C3, typename C4,
+          typename C5>
+void nanosort_soa(It first, It last, C1 c1, C2 c2, C3 c3, C4 c4, C5 c5) {
+  nanosort_detail::sort_soa(first, last, nanosort_detail::SoaEnd(), c1, c2,
+                            c3, c4, c5);
+}
+
+template <typename It, typename C1, typename C2, typename C3, typename C4,
+          typename C5, typename C6>
+void nanosort_soa(It first, It last, C1 c1, C2 c2, C3 c3, C4 c4, C5 c5,
+                  C6 c6) {
+  nanosort_detail::sort_soa(first, last, nanosort_detail::SoaEnd(), c1, c2,
+                            c3, c4, c5, c6);
+}
+
+// Merges k sorted runs [first[i], last[i]) into out, which must not overlap the
+// runs; elements are copied and equal elements are taken from earlier runs
+// first. Uses O(N log k) comparisons
+template <typename It, typename OutIt, typename Compare>
+OutIt nanosort_merge_k(const It* first, const It* last, size_t k, OutIt out,
+                       Compare comp) {
+  size_t m = 0;
+
+  for (size_t i = 0; i < k; ++i) m += first[i] != last[i];
+
+  // Small merges keep the list of non-empty runs on stack
+  It sf[4], sl[4];
+  nanosort_detail::Buffer<It> bf(m > 4 ? m : 0), bl(m > 4 ? m : 0);
+
+  It* f = m > 4 ? bf.data : sf;
+  It* l = m > 4 ? bl.data : sl;
+
+  for (size_t i = 0, j = 0; i < k; ++i) {
+    if (first[i] != last[i]) {
+      f[j] = first[i];
+      l[j] = last[i];
+      j++;
+    }
+  }
+
+  if (m > 4) return nanosort_detail::merge_tree(f, l, m, out, comp);
+  if (m > 0) return nanosort_detail::merge_small(f, l, m, out, comp);
+
+  return out;
+}
+
+template <typename It, typename OutIt>
+OutIt nanosort_merge_k(const It* first, const It* last, size_t k, OutIt out) {
+  return nanosort_merge_k(first, last, k, out, nanosort_detail::Less());
+}
+
+// Sorts huge arrays faster than nanosort when they don't fit in cache, using
+// in-place samplesort: each level distributes elements into up to 256 buckets
+// in one pass, and buckets that fit in cache are sorted with nanosort.
+// Allocates fixed size scratch memory, around 0.5 MB for small types
+template <typename It, typename Compare>
+void nanosort_samplesort(It first, It last, Compare comp) {
+  typedef typename nanosort_detail::IteratorTraits<It>::value_type T;
+
+  size_t n = last - first;
+
+  if (n <= nanosort_detail::SampleSortSize<T>::base) {
+    nanosort_detail::sort<T>(first, last, n, comp);
+    return;
+  }
+
+  nanosort_detail::SampleSortState<T> state;
+  nanosort_detail::samplesort<T>(state, first, last,
+                                 nanosort_detail::kSampleSortLevels, comp);
+}
+
+template <typename It>
+void nanosort_samplesort(It first, It last) {
+  nanosort_samplesort(first, last, nanosort_detail::Less());
+}
+
+// Sorts N elements starting at first with a sorting network that is expanded
+// and checked at compile time; N must be at most 32
+template <int N, typename It, typename Compare>
+NANOSORT_CONSTEXPR void nanosort_fixed(It first, Compare comp) {
+  typedef typename nanosort_detail::IteratorTraits<It>::value_type T;
+
+  nanosort_detail::sort_fixed<N, T>(first, comp);
+}
+
+template <int N, typename It>
+NANOSORT_CONSTEXPR void nanosort_fixed(It first) {
+  nanosort_fixed<N>(first, nanosort_detail::Less());
 }
 
 /**
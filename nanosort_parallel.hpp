@@ -0,0 +1,684 @@
+/**
+ * nanosort_parallel
+ *
+ * Copyright (C) 2021, by Arseny Kapoulkine (arseny.kapoulkine@gmail.com)
+ * Report bugs and download new versions at https://github.com/zeux/nanosort
+ *
+ * This library is distributed under the MIT License. See notice at the end of
+ * nanosort.hpp.
+ *
+ * Multi-threaded extension of nanosort; unlike nanosort.hpp, this header
+ * requires C++11 and uses the standard library for threads.
+ */
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "nanosort.hpp"
+
+namespace nanosort_detail {
+
+// Thread pool with one task deque per worker; workers pop their own tasks in
+// LIFO order and steal from the other end of other deques when they run out.
+class TaskPool {
+ public:
+  typedef std::function<void(unsigned)> Function;
+
+  explicit TaskPool(unsigned threads) : done(false) {
+    if (threads == 0) threads = 1;
+
+    for (unsigned i = 0; i < threads; ++i) {
+      queues.push_back(std::unique_ptr<Queue>(new Queue()));
+    }
+
+    // worker 0 is the calling thread which participates via wait()
+    for (unsigned i = 1; i < threads; ++i) {
+      workers.push_back(std::thread(&TaskPool::worker, this, i));
+    }
+  }
+
+  ~TaskPool() {
+    done.store(true, std::memory_order_release);
+
+    for (size_t i = 0; i < workers.size(); ++i) workers[i].join();
+  }
+
+  unsigned size() const { return unsigned(queues.size()); }
+
+  // Queue task on worker's deque; pending is decremented once task completes
+  void spawn(unsigned worker, Function fn, std::atomic<size_t>& pending) {
+    pending.fetch_add(1, std::memory_order_relaxed);
+
+    Queue& q = *queues[worker];
+    std::lock_guard<std::mutex> lock(q.lock);
+    q.tasks.push_back(Task(NANOSORT_MOVE(fn), &pending));
+  }
+
+  // Execute queued tasks on worker until pending reaches zero
+  void wait(unsigned worker, std::atomic<size_t>& pending) {
+    while (pending.load(std::memory_order_acquire) != 0) {
+      if (!run(worker)) std::this_thread::yield();
+    }
+  }
+
+ private:
+  struct Task {
+    Function fn;
+    std::atomic<size_t>* pending;
+
+    Task() : pending(0) {}
+    Task(Function fn_, std::atomic<size_t>* pending_)
+        : fn(NANOSORT_MOVE(fn_)), pending(pending_) {}
+  };
+
+  struct Queue {
+    std::mutex lock;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<std::unique_ptr<Queue> > queues;
+  std::vector<std::thread> workers;
+  std::atomic<bool> done;
+
+  bool pop(unsigned worker, Task& task) {
+    Queue& q = *queues[worker];
+    std::lock_guard<std::mutex> lock(q.lock);
+    if (q.tasks.empty()) return false;
+
+    task = NANOSORT_MOVE(q.tasks.back());
+    q.tasks.pop_back();
+    return true;
+  }
+
+  bool steal(unsigned worker, Task& task) {
+    for (unsigned i = 1; i < queues.size(); ++i) {
+      Queue& q = *queues[(worker + i) % queues.size()];
+      std::lock_guard<std::mutex> lock(q.lock);
+      if (q.tasks.empty()) continue;
+
+      task = NANOSORT_MOVE(q.tasks.front());
+      q.tasks.pop_front();
+      return true;
+    }
+
+    return false;
+  }
+
+  bool run(unsigned worker) {
+    Task task;
+    if (!pop(worker, task) && !steal(worker, task)) return false;
+
+    task.fn(worker);
+    task.pending->fetch_sub(1, std::memory_order_acq_rel);
+    return true;
+  }
+
+  void worker(unsigned index) {
+    while (!done.load(std::memory_order_acquire)) {
+      if (!run(index)) std::this_thread::yield();
+    }
+  }
+};
+
+// Subranges below this size are always sorted by a single thread
+const size_t kParallelGrain = 1 << 14;
+
+// Split array into left/right parts using part() on chunks in parallel, then
+// swap misplaced elements so that the left elements of all chunks come first
+template <typename It, typename Partition>
+It parallel_partition(TaskPool& pool, unsigned worker, It first, It last,
+                      unsigned chunks, Partition part) {
+  size_t n = last - first;
+
+  std::vector<size_t> bounds(chunks + 1);
+  std::vector<size_t> split(chunks);
+
+  for (unsigned i = 0; i <= chunks; ++i) bounds[i] = n * i / chunks;
+
+  std::atomic<size_t> pending(0);
+
+  for (unsigned i = 1; i < chunks; ++i) {
+    pool.spawn(
+        worker,
+        [=, &bounds, &split](unsigned) {
+          split[i] = part(first + bounds[i], first + bounds[i + 1]) -
+                     (first + bounds[i]);
+        },
+        pending);
+  }
+
+  split[0] = part(first, first + bounds[1]) - first;
+  pool.wait(worker, pending);
+
+  size_t mid = 0;
+  for (unsigned i = 0; i < chunks; ++i) mid += split[i];
+
+  // Misplaced elements are right elements before mid and left elements after
+  // mid; both lists are sorted by position and have the same total size
+  std::vector<size_t> rs, re, ls, le;
+
+  for (unsigned i = 0; i < chunks; ++i) {
+    size_t cmid = bounds[i] + split[i];
+
+    if (cmid < mid && cmid < bounds[i + 1]) {
+      rs.push_back(cmid);
+      re.push_back(bounds[i + 1] < mid ? bounds[i + 1] : mid);
+    }
+
+    if (cmid > mid && bounds[i] < cmid) {
+      ls.push_back(bounds[i] > mid ? bounds[i] : mid);
+      le.push_back(cmid);
+    }
+  }
+
+  size_t count = 0;
+  for (size_t i = 0; i < rs.size(); ++i) count += re[i] - rs[i];
+
+  // Swap k-th misplaced right element with k-th misplaced left element; this
+  // is split into chunks of equal size that walk both interval lists
+  struct Swapper {
+    static void run(It first, const std::vector<size_t>& rs,
+                    const std::vector<size_t>& re,
+                    const std::vector<size_t>& ls,
+                    const std::vector<size_t>& le, size_t begin, size_t end) {
+      size_t ri = 0, li = 0;
+      size_t ro = begin, lo = begin;
+
+      while (ro >= re[ri] - rs[ri]) ro -= re[ri] - rs[ri], ri++;
+      while (lo >= le[li] - ls[li]) lo -= le[li] - ls[li], li++;
+
+      for (size_t k = begin; k < end; ++k) {
+        swap(first[rs[ri] + ro], first[ls[li] + lo]);
+
+        if (++ro == re[ri] - rs[ri]) ro = 0, ri++;
+        if (++lo == le[li] - ls[li]) lo = 0, li++;
+      }
+    }
+  };
+
+  unsigned pieces = unsigned(count / kParallelGrain);
+  pieces = pieces < 1 ? 1 : pieces > chunks ? chunks : pieces;
+
+  for (unsigned i = 1; i < pieces; ++i) {
+    pool.spawn(
+        worker,
+        [=, &rs, &re, &ls, &le](unsigned) {
+          Swapper::run(first, rs, re, ls, le, count * i / pieces,
+                       count * (i + 1) / pieces);
+        },
+        pending);
+  }
+
+  if (count) Swapper::run(first, rs, re, ls, le, 0, count / pieces);
+  pool.wait(worker, pending);
+
+  return first + mid;
+}
+
+template <typename T, typename It, typename Compare>
+void parallel_sort(TaskPool& pool, unsigned worker, It first, It last,
+                   size_t limit, Compare comp, size_t grain,
+                   std::atomic<size_t>& pending) {
+  for (;;) {
+    size_t n = last - first;
+
+    if (n <= grain || limit == 0) {
+      sort<T>(first, last, limit, comp);
+      return;
+    }
+
+    T pivot = median5<T>(first, last, comp);
+
+    // Top levels are too large to leave to one thread, so partition in chunks
+    unsigned chunks = unsigned(n / grain);
+    chunks = chunks > pool.size() ? pool.size() : chunks;
+
+    It mid = chunks > 1 ? parallel_partition(pool, worker, first, last, chunks,
+                                             [&](It l, It r) {
+                                               return partition(pivot, l, r,
+                                                                comp);
+                                             })
+                        : partition(pivot, first, last, comp);
+
+    // For skewed partitions compute new midpoint by separating equal elements
+    It midr = mid;
+    if (NANOSORT_UNLIKELY(mid - first <= (last - first) >> 3)) {
+      midr = chunks > 1 ? parallel_partition(pool, worker, mid, last, chunks,
+                                             [&](It l, It r) {
+                                               return partition_rev(pivot, l,
+                                                                    r, comp);
+                                             })
+                        : partition_rev(pivot, mid, last, comp);
+    }
+
+    // Per MSVC STL, this allows 1.5 log2(N) recursive steps
+    limit = (limit >> 1) + (limit >> 2);
+
+    // Left part becomes a stealable task, right part continues on this thread
+    pool.spawn(
+        worker,
+        [=, &pool, &pending](unsigned w) {
+          parallel_sort<T>(pool, w, first, mid, limit, comp, grain, pending);
+        },
+        pending);
+
+    first = midr;
+  }
+}
+
+// Runs fn(i) for i in [0, count) as separate tasks; fn(0) runs on the calling
+// worker
+template <typename Function>
+void parallel_run(TaskPool& pool, unsigned worker, unsigned count,
+                  Function fn) {
+  std::atomic<size_t> pending(0);
+
+  for (unsigned i = 1; i < count; ++i)
+    pool.spawn(worker, [=](unsigned) { fn(i); }, pending);
+
+  fn(0);
+  pool.wait(worker, pending);
+}
+
+// Samplesort buffers shared by all workers; stripes of a level may be
+// classified on any worker and keep elements in their buffers until the level
+// is distributed, so buffers are taken from a free list and returned when the
+// level or a sequential sort is done
+template <typename T>
+class SampleSortStates {
+ public:
+  SampleSortState<T>* acquire() {
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (free.empty()) {
+      owned.push_back(std::unique_ptr<SampleSortState<T> >(
+          new SampleSortState<T>()));
+      return owned.back().get();
+    }
+
+    SampleSortState<T>* result = free.back();
+    free.pop_back();
+    return result;
+  }
+
+  void release(SampleSortState<T>* state) {
+    std::lock_guard<std::mutex> guard(lock);
+    free.push_back(state);
+  }
+
+ private:
+  std::mutex lock;
+  std::vector<std::unique_ptr<SampleSortState<T> > > owned;
+  std::vector<SampleSortState<T>*> free;
+};
+
+// Write and read pointers of each bucket are updated together under its lock;
+// reading counts blocks that are being moved out of the bucket, which must
+// finish before a block is written to a free slot of the bucket
+struct SamplePermuteSync {
+  std::vector<std::mutex> locks;
+  std::vector<std::atomic<size_t> > reading;
+  std::atomic<size_t> overflow;
+
+  SamplePermuteSync(size_t buckets, size_t n)
+      : locks(buckets), reading(buckets), overflow(n) {
+    for (size_t b = 0; b < buckets; ++b) reading[b].store(0);
+  }
+};
+
+// Parallel version of sample_permute, similar to IPS4o; every task starts at a
+// different bucket and takes unprocessed blocks from each bucket in turn,
+// moving them with the swap buffers of local
+template <bool Equal, typename T, typename It, typename Compare>
+void parallel_permute(SampleSortState<T>& state, SampleSortState<T>& local,
+                      SamplePermuteSync& sync, It first, size_t n,
+                      size_t log_k, size_t buckets, size_t start,
+                      Compare comp) {
+  const size_t block = SampleSortSize<T>::block;
+
+  size_t* write = state.write.data;
+  size_t* read = state.read.data;
+
+  T* current = local.swap.data;
+  T* next = local.swap.data + block;
+
+  for (size_t i = 0; i < buckets; ++i) {
+    size_t b = (start + i) % buckets;
+
+    for (;;) {
+      size_t src;
+
+      {
+        std::lock_guard<std::mutex> guard(sync.locks[b]);
+        if (read[b] <= write[b]) break;
+
+        read[b] -= block;
+        src = read[b];
+        sync.reading[b].fetch_add(1, std::memory_order_relaxed);
+      }
+
+      move_block<T>(first + src, block, current);
+      sync.reading[b].fetch_sub(1, std::memory_order_release);
+
+      for (;;) {
+        size_t dest = sample_bucket<Equal>(state.tree.data, state.lower.data,
+                                           log_k, current[0], comp);
+        size_t pos;
+        bool occupied;
+
+        {
+          std::lock_guard<std::mutex> guard(sync.locks[dest]);
+          pos = write[dest];
+          write[dest] += block;
+          occupied = pos < read[dest];
+        }
+
+        if (occupied) {
+          move_block<T>(first + pos, block, next);
+          move_block<T>(current, block, first + pos);
+
+          T* t = current;
+          current = next;
+          next = t;
+          continue;
+        }
+
+        // Free slot may still be read by the task that took its block
+        while (sync.reading[dest].load(std::memory_order_acquire) != 0)
+          std::this_thread::yield();
+
+        if (pos + block > n) {
+          move_block<T>(current, block, state.overflow.data);
+          sync.overflow.store(pos, std::memory_order_relaxed);
+        } else {
+          move_block<T>(current, block, first + pos);
+        }
+        break;
+      }
+    }
+  }
+}
+
+// Parallel version of sample_distribute; block moves, the permutation and
+// filling of buckets are split between count tasks
+template <typename T, typename It, typename Compare>
+void parallel_distribute(TaskPool& pool, unsigned worker,
+                         SampleSortState<T>* const* states,
+                         const size_t* stripes, const size_t* full,
+                         unsigned count, It first, It last, size_t log_k,
+                         bool equal, size_t* bounds, Compare comp) {
+  const size_t block = SampleSortSize<T>::block;
+  size_t n = last - first;
+  size_t buckets = (equal ? 2 : 1) << log_k;
+
+  SampleSortState<T>& state = *states[0];
+
+  // Moved blocks don't overlap, so they are collected first
+  std::vector<size_t> moves;
+  size_t full_end = sample_compact(stripes, full, count, block,
+                                   [&](size_t src, size_t dest) {
+                                     moves.push_back(src);
+                                     moves.push_back(dest);
+                                   });
+
+  size_t blocks = moves.size() / 2;
+
+  parallel_run(pool, worker, count, [&](unsigned i) {
+    for (size_t k = blocks * i / count; k < blocks * (i + 1) / count; ++k)
+      move_block<T>(first + moves[2 * k], block, first + moves[2 * k + 1]);
+  });
+
+  sample_pointers(states, count, buckets, full_end, bounds);
+
+  SamplePermuteSync sync(buckets, n);
+
+  parallel_run(pool, worker, count, [&](unsigned i) {
+    size_t start = buckets * i / count;
+
+    if (equal)
+      parallel_permute<true>(state, *states[i], sync, first, n, log_k,
+                             buckets, start, comp);
+    else
+      parallel_permute<false>(state, *states[i], sync, first, n, log_k,
+                              buckets, start, comp);
+  });
+
+  size_t overflow = sync.overflow.load(std::memory_order_relaxed);
+
+  if (overflow < n)
+    move_block<T>(state.overflow.data, n - overflow, first + overflow);
+
+  // Buckets are filled in ranges; elements past the end of the last bucket of
+  // a range are saved to the swap buffers of the next stripe since they are
+  // in the first block of the next range
+  unsigned ranges = count < buckets ? count : unsigned(buckets);
+
+  for (unsigned i = 1; i < ranges; ++i)
+    sample_save(state, first, n, overflow, bounds, buckets * i / ranges - 1,
+                states[i]->swap.data);
+
+  parallel_run(pool, worker, ranges, [&](unsigned i) {
+    size_t begin = buckets * i / ranges, end = buckets * (i + 1) / ranges;
+
+    for (size_t b = begin; b < end; ++b)
+      sample_fill(states, count, first, n, overflow, bounds, b,
+                  b + 1 == end && i + 1 < ranges ? states[i + 1]->swap.data
+                                                 : static_cast<T*>(0));
+  });
+}
+
+// Samplesort level that classifies stripes of the array and distributes blocks
+// into buckets in parallel; buckets become stealable tasks
+template <typename T, typename It, typename Compare>
+void parallel_samplesort(TaskPool& pool, unsigned worker,
+                         SampleSortStates<T>& states, It first, It last,
+                         size_t levels, Compare comp, size_t grain,
+                         std::atomic<size_t>& pending) {
+  const size_t block = SampleSortSize<T>::block;
+  size_t n = last - first;
+
+  if (n <= grain || n <= SampleSortSize<T>::base || levels == 0) {
+    SampleSortState<T>* state = states.acquire();
+    samplesort<T>(*state, first, last, levels, comp);
+    states.release(state);
+    return;
+  }
+
+  unsigned count = unsigned(n / grain);
+  count = count > pool.size() ? pool.size() : count;
+
+  std::vector<SampleSortState<T>*> stripe_states(count);
+  for (unsigned i = 0; i < count; ++i) stripe_states[i] = states.acquire();
+
+  bool equal;
+  size_t log_k = sample_splitters(*stripe_states[0], first, last, equal, comp);
+
+  for (unsigned i = 1; i < count; ++i) {
+    for (size_t k = 1; k < (size_t(1) << log_k); ++k) {
+      stripe_states[i]->tree.data[k] = stripe_states[0]->tree.data[k];
+      stripe_states[i]->lower.data[k] = stripe_states[0]->lower.data[k];
+    }
+
+    stripe_states[i]->lower.data[0] = stripe_states[0]->lower.data[0];
+  }
+
+  std::vector<size_t> stripes(count + 1);
+  std::vector<size_t> full(count);
+
+  // Stripes start at block boundaries so that gaps between blocks of
+  // different stripes are whole blocks
+  for (unsigned i = 0; i < count; ++i)
+    stripes[i] = n * i / count / block * block;
+  stripes[count] = n;
+
+  parallel_run(pool, worker, count, [&](unsigned i) {
+    full[i] = sample_classify(*stripe_states[i], first + stripes[i],
+                              first + stripes[i + 1], log_k, equal, comp);
+  });
+
+  size_t bounds[kSampleSortBuckets * 2 + 1];
+  parallel_distribute(pool, worker, &stripe_states[0], &stripes[0], &full[0],
+                      count, first, last, log_k, equal, bounds, comp);
+
+  for (unsigned i = 0; i < count; ++i) states.release(stripe_states[i]);
+
+  // Buckets of elements equal to a splitter are already sorted
+  size_t buckets = (equal ? 2 : 1) << log_k;
+
+  for (size_t b = equal; b < buckets; b += 1 + equal) {
+    if (bounds[b] == bounds[b + 1]) continue;
+
+    It bf = first + bounds[b], bl = first + bounds[b + 1];
+
+    pool.spawn(
+        worker,
+        [=, &pool, &states, &pending](unsigned w) {
+          parallel_samplesort<T>(pool, w, states, bf, bl, levels - 1, comp,
+                                 grain, pending);
+        },
+        pending);
+  }
+}
+
+}  // namespace nanosort_detail
+
+template <typename It, typename Compare>
+void nanosort_parallel(It first, It last, Compare comp, unsigned threads = 0) {
+  typedef typename nanosort_detail::IteratorTraits<It>::value_type T;
+
+  if (threads == 0) threads = std::thread::hardware_concurrency();
+
+  size_t n = last - first;
+
+  // Aim for several tasks per thread so that stealing can balance the load
+  size_t grain = n / (size_t(threads) * 16);
+  grain = grain < nanosort_detail::kParallelGrain
+              ? nanosort_detail::kParallelGrain
+              : grain;
+
+  if (threads <= 1 || n <= grain) {
+    nanosort_detail::sort<T>(first, last, n, comp);
+    return;
+  }
+
+  nanosort_detail::TaskPool pool(threads);
+  std::atomic<size_t> pending(0);
+
+  nanosort_detail::parallel_sort<T>(pool, 0, first, last, n, comp, grain,
+                                    pending);
+  pool.wait(0, pending);
+}
+
+template <typename It>
+void nanosort_parallel(It first, It last) {
+  nanosort_parallel(first, last, nanosort_detail::Less());
+}
+
+// Segmented version of nanosort_parallel; groups of small segments are sorted
+// by separate tasks and large segments are sorted using multiple threads
+template <typename It, typename OffsetIt, typename Compare>
+void nanosort_segmented_parallel(It data, OffsetIt offsets, size_t count,
+                                 Compare comp, unsigned threads = 0) {
+  typedef typename nanosort_detail::IteratorTraits<It>::value_type T;
+
+  if (threads == 0) threads = std::thread::hardware_concurrency();
+
+  size_t n = count ? offsets[count] - offsets[0] : 0;
+
+  size_t grain = n / (size_t(threads) * 16);
+  grain = grain < nanosort_detail::kParallelGrain
+              ? nanosort_detail::kParallelGrain
+              : grain;
+
+  if (threads <= 1 || n <= grain) {
+    nanosort_detail::sort_segments<T>(data, offsets, count, comp);
+    return;
+  }
+
+  nanosort_detail::TaskPool pool(threads);
+  std::atomic<size_t> pending(0);
+
+  size_t begin = 0;
+
+  for (size_t i = 0; i <= count; ++i) {
+    size_t size = i < count ? offsets[i + 1] - offsets[i] : 0;
+
+    // Segments before a large one, or a group that has enough elements, or
+    // the last group become one task
+    if (begin < i && (size > grain || i == count ||
+                      size_t(offsets[i] - offsets[begin]) >= grain)) {
+      OffsetIt group = offsets + begin;
+      size_t group_count = i - begin;
+
+      pool.spawn(
+          0,
+          [=](unsigned) {
+            nanosort_detail::sort_segments<T>(data, group, group_count, comp);
+          },
+          pending);
+
+      begin = i;
+    }
+
+    if (size > grain) {
+      nanosort_detail::parallel_sort<T>(pool, 0, data + offsets[i],
+                                        data + offsets[i + 1], size, comp,
+                                        grain, pending);
+      begin = i + 1;
+    }
+  }
+
+  pool.wait(0, pending);
+}
+
+template <typename It, typename OffsetIt>
+void nanosort_segmented_parallel(It data, OffsetIt offsets, size_t count) {
+  nanosort_segmented_parallel(data, offsets, count, nanosort_detail::Less());
+}
+
+// Version of nanosort_samplesort that splits the top levels into tasks for a
+// pool of threads: parts of the array are classified, blocks are permuted and
+// buckets are filled by separate tasks, and buckets are sorted by separate
+// tasks. Scaling hasn't been measured on machines with many cores yet
+template <typename It, typename Compare>
+void nanosort_samplesort_parallel(It first, It last, Compare comp,
+                                  unsigned threads = 0) {
+  typedef typename nanosort_detail::IteratorTraits<It>::value_type T;
+
+  if (threads == 0) threads = std::thread::hardware_concurrency();
+
+  size_t n = last - first;
+
+  size_t grain = n / (size_t(threads) * 16);
+  grain = grain < nanosort_detail::kParallelGrain
+              ? nanosort_detail::kParallelGrain
+              : grain;
+
+  if (threads <= 1 || n <= grain) {
+    nanosort_samplesort(first, last, comp);
+    return;
+  }
+
+  nanosort_detail::TaskPool pool(threads);
+  std::atomic<size_t> pending(0);
+
+  // Buffers are reused by all levels and buckets, so at most one buffer per
+  // stripe or bucket that is being processed at the same time is allocated
+  nanosort_detail::SampleSortStates<T> states;
+
+  nanosort_detail::parallel_samplesort<T>(pool, 0, states, first, last,
+                                          nanosort_detail::kSampleSortLevels,
+                                          comp, grain, pending);
+  pool.wait(0, pending);
+}
+
+template <typename It>
+void nanosort_samplesort_parallel(It first, It last) {
+  nanosort_samplesort_parallel(first, last, nanosort_detail::Less());
+}
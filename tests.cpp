@@ -1,11 +1,16 @@
 // This file is part of nanosort library; see nanosort.hpp for license details
 #include <assert.h>
+#include <math.h>
+#include <string.h>
 
 #include <algorithm>
+#include <array>
 #include <functional>
+#include <string>
 #include <vector>
 
 #include "nanosort.hpp"
+#include "nanosort_parallel.hpp"
 
 template <typename T, typename Compare = std::less<T> >
 void test_sort(const std::vector<T>& a, Compare comp = std::less<T>()) {
@@ -35,6 +40,404 @@ void test_sort(const std::vector<T>& a, Compare comp = std::less<T>()) {
   assert(es == ss);
 }
 
+template <typename T, typename Compare = std::less<T> >
+void test_parallel(const std::vector<T>& a, Compare comp = std::less<T>()) {
+  std::vector<T> ps = a;
+  nanosort_parallel(ps.begin(), ps.end(), comp, 4);
+
+  std::vector<T> es = a;
+  std::sort(es.begin(), es.end(), comp);
+
+  assert(std::is_sorted(ps.begin(), ps.end(), comp));
+  assert(es == ps);
+}
+
+template <typename T, typename Compare = std::less<T> >
+void test_samplesort(const std::vector<T>& a, Compare comp = std::less<T>()) {
+  std::vector<T> es = a;
+  std::sort(es.begin(), es.end(), comp);
+
+  std::vector<T> ss = a;
+  nanosort_samplesort(ss.begin(), ss.end(), comp);
+  assert(es == ss);
+
+  std::vector<T> ps = a;
+  nanosort_samplesort_parallel(ps.begin(), ps.end(), comp, 4);
+  assert(es == ps);
+}
+
+// Sorts each consecutive group of N elements with a sorting network
+template <int N, typename T, typename Compare = std::less<T> >
+void test_fixed(const std::vector<T>& a, Compare comp = std::less<T>()) {
+  std::vector<T> fs = a;
+  std::vector<T> es = a;
+
+  for (size_t i = 0; i + N <= a.size(); i += N) {
+    nanosort_fixed<N>(fs.begin() + i, comp);
+    std::sort(es.begin() + i, es.begin() + i + N, comp);
+  }
+
+  assert(es == fs);
+}
+
+template <typename T>
+void test_radix(const std::vector<T>& a) {
+  std::vector<T> rs = a;
+  nanosort_radix(rs.begin(), rs.end());
+
+  std::vector<T> ls = a;
+  std::vector<T> scratch(a.size());
+  nanosort_radix(ls.begin(), ls.end(), nanosort_detail::Identity(),
+                 scratch.begin());
+
+  std::vector<T> es = a;
+  std::sort(es.begin(), es.end());
+
+  assert(es == rs);
+  assert(es == ls);
+}
+
+template <typename T, typename Compare = std::less<T> >
+void test_adaptive(const std::vector<T>& a, Compare comp = std::less<T>()) {
+  std::vector<T> as = a;
+  nanosort_adaptive(as.begin(), as.end(), comp);
+
+  std::vector<T> es = a;
+  std::sort(es.begin(), es.end(), comp);
+
+  assert(es == as);
+}
+
+template <typename T, typename Compare = std::less<T> >
+void test_unique(const std::vector<T>& a, Compare comp = std::less<T>()) {
+  std::vector<T> es = a;
+  std::sort(es.begin(), es.end(), comp);
+  es.erase(std::unique(es.begin(), es.end()), es.end());
+
+  std::vector<T> us = a;
+  us.erase(nanosort_unique(us.begin(), us.end(), comp), us.end());
+
+  assert(es == us);
+}
+
+template <typename T, typename Compare = std::less<T> >
+void test_select(const std::vector<T>& a, Compare comp = std::less<T>()) {
+  std::vector<T> es = a;
+  std::sort(es.begin(), es.end(), comp);
+
+  for (size_t k = 0; k < a.size(); k += k < 8 ? 1 : 1 + a.size() / 7) {
+    std::vector<T> ss = a;
+    nanosort_select(ss.begin(), ss.begin() + k, ss.end(), comp);
+
+    assert(ss[k] == es[k]);
+    for (size_t i = 0; i < k; ++i) assert(!comp(ss[k], ss[i]));
+    for (size_t i = k; i < ss.size(); ++i) assert(!comp(ss[i], ss[k]));
+
+    // Median of medians fallback is used when the recursion limit is reached
+    std::vector<T> ms = a;
+    nanosort_detail::select_nth<T>(ms.begin(), ms.begin() + k, ms.end(), 0,
+                                   comp);
+
+    assert(ms[k] == es[k]);
+    for (size_t i = 0; i < k; ++i) assert(!comp(ms[k], ms[i]));
+    for (size_t i = k; i < ms.size(); ++i) assert(!comp(ms[i], ms[k]));
+
+    std::vector<T> ps = a;
+    nanosort_partial(ps.begin(), ps.begin() + k, ps.end(), comp);
+
+    assert(std::equal(ps.begin(), ps.begin() + k, es.begin()));
+  }
+
+  std::vector<size_t> ranks;
+  for (size_t k = 0; k < a.size(); k += 1 + a.size() / 11) ranks.push_back(k);
+  if (!a.empty()) ranks.push_back(a.size() - 1);
+
+  std::vector<T> qs = a;
+  nanosort_quantiles(qs.begin(), qs.end(), ranks.begin(), ranks.size(), comp);
+
+  for (size_t i = 0; i < ranks.size(); ++i)
+    assert(qs[ranks[i]] == es[ranks[i]]);
+}
+
+template <typename T, typename Compare>
+void test_stable(const std::vector<T>& a, Compare comp) {
+  std::vector<T> ss = a;
+  std::vector<T> scratch(a.size());
+  nanosort_stable(ss.begin(), ss.end(), comp, scratch.begin());
+
+  std::vector<T> es = a;
+  std::stable_sort(es.begin(), es.end(), comp);
+
+  assert(es == ss);
+}
+
+struct PairFirstLess {
+  bool operator()(const std::pair<int, int>& l,
+                  const std::pair<int, int>& r) const {
+    return l.first < r.first;
+  }
+};
+
+template <typename T, typename KeyFn, typename Compare>
+void test_by_key(const std::vector<T>& a, KeyFn keyfn, Compare comp) {
+  std::vector<T> ks = a;
+  nanosort_by_key(ks.begin(), ks.end(), keyfn, comp);
+
+  for (size_t i = 1; i < ks.size(); ++i)
+    assert(!comp(keyfn(ks[i]), keyfn(ks[i - 1])));
+
+  // The result must be a permutation of the input
+  std::vector<T> es = a;
+  std::sort(es.begin(), es.end());
+  std::sort(ks.begin(), ks.end());
+
+  assert(es == ks);
+}
+
+template <typename T, typename Index, typename Compare>
+void test_indices(const std::vector<T>& a, Compare comp) {
+  std::vector<Index> perm(a.size());
+  nanosort_indices(a.begin(), a.end(), comp, perm.begin());
+
+  for (size_t i = 1; i < perm.size(); ++i)
+    assert(!comp(a[perm[i]], a[perm[i - 1]]));
+
+  // Applying the permutation must produce the same order as indexing
+  std::vector<T> ps = a;
+  nanosort_apply_permutation(ps.begin(), ps.end(), perm.begin());
+
+  for (size_t i = 0; i < perm.size(); ++i) assert(ps[i] == a[perm[i]]);
+
+  std::vector<T> es = a;
+  std::sort(es.begin(), es.end(), comp);
+  std::sort(ps.begin(), ps.end(), comp);
+
+  assert(es == ps);
+}
+
+// Sorts keys together with columns of row numbers, strings and doubles; every
+// column must be permuted the same way as the keys
+template <typename T>
+void test_soa(const std::vector<T>& a) {
+  size_t n = a.size();
+
+  std::vector<T> keys = a;
+  std::vector<unsigned int> rows(n);
+  std::vector<std::string> names(n);
+  std::vector<double> values(n + 1);
+
+  for (size_t i = 0; i < n; ++i) {
+    rows[i] = unsigned(i);
+    names[i] = std::to_string(i);
+    values[i] = double(i) / 2;
+  }
+
+  nanosort_soa(keys.begin(), keys.end(), rows.begin(), names.begin(),
+               &values[0]);
+
+  std::vector<T> es = a;
+  std::sort(es.begin(), es.end());
+  assert(es == keys);
+
+  for (size_t i = 0; i < n; ++i) {
+    assert(keys[i] == a[rows[i]]);
+    assert(names[i] == std::to_string(rows[i]));
+    assert(values[i] == double(rows[i]) / 2);
+  }
+
+  std::vector<unsigned int> cols[6];
+  for (int j = 0; j < 6; ++j)
+    for (size_t i = 0; i < n; ++i) cols[j].push_back(unsigned(i * 7 + j));
+
+  keys = a;
+  nanosort_soa(keys.begin(), keys.end(), cols[0].begin(), cols[1].begin(),
+               cols[2].begin(), cols[3].begin(), cols[4].begin(),
+               cols[5].begin());
+  assert(es == keys);
+
+  for (size_t i = 0; i < n; ++i) {
+    size_t row = cols[0][i] / 7;
+    assert(keys[i] == a[row]);
+    for (int j = 1; j < 6; ++j) assert(cols[j][i] == unsigned(row * 7 + j));
+  }
+}
+
+struct StringView {
+  const char* ptr;
+  size_t len;
+
+  const char* data() const { return ptr; }
+  size_t size() const { return len; }
+};
+
+struct StringFirst {
+  const std::string& operator()(const std::pair<std::string, size_t>& p) const {
+    return p.first;
+  }
+};
+
+// Strings are sorted by bytes compared as unsigned chars, same as std::string;
+// C strings end at the first zero byte
+void test_strings(const std::vector<std::string>& a) {
+  std::vector<std::string> es = a;
+  std::sort(es.begin(), es.end());
+
+  std::vector<std::string> ss = a;
+  nanosort_strings(ss.begin(), ss.end());
+  assert(es == ss);
+
+  std::vector<StringView> vs(a.size());
+  for (size_t i = 0; i < a.size(); ++i) {
+    vs[i].ptr = a[i].data();
+    vs[i].len = a[i].size();
+  }
+
+  nanosort_strings(vs.begin(), vs.end());
+  for (size_t i = 0; i < a.size(); ++i)
+    assert(std::string(vs[i].ptr, vs[i].len) == es[i]);
+
+  std::vector<const char*> cs(a.size());
+  for (size_t i = 0; i < a.size(); ++i) cs[i] = a[i].c_str();
+
+  nanosort_strings(cs.begin(), cs.end());
+  for (size_t i = 1; i < a.size(); ++i) assert(strcmp(cs[i - 1], cs[i]) <= 0);
+
+  std::vector<std::pair<std::string, size_t> > ps(a.size());
+  for (size_t i = 0; i < a.size(); ++i) ps[i] = std::make_pair(a[i], i);
+
+  nanosort_strings(ps.begin(), ps.end(), StringFirst());
+  for (size_t i = 0; i < a.size(); ++i) {
+    assert(ps[i].first == es[i]);
+    assert(a[ps[i].second] == es[i]);
+  }
+
+  // Strings returned by value must stay alive while they are compared
+  std::reverse(ps.begin(), ps.end());
+  nanosort_strings(ps.begin(), ps.end(),
+                   [](const std::pair<std::string, size_t>& p) {
+                     return p.first;
+                   });
+  for (size_t i = 0; i < a.size(); ++i) assert(ps[i].first == es[i]);
+}
+
+// Sorts raw arrays with the default comparator, which uses SIMD partitioning
+// for primitive types when it's enabled
+template <typename T>
+void test_simd(const std::vector<T>& a) {
+  std::vector<T> ns = a;
+  nanosort(&ns[0], &ns[0] + ns.size());
+
+  std::vector<T> es = a;
+  std::sort(es.begin(), es.end());
+
+  assert(es == ns);
+}
+
+template <typename T, typename Compare>
+void test_segmented(const std::vector<T>& a, const std::vector<size_t>& offsets,
+                    Compare comp) {
+  size_t count = offsets.size() - 1;
+
+  std::vector<T> ns = a;
+  nanosort_segmented(ns.begin(), offsets.begin(), count, comp);
+
+  std::vector<T> ps = a;
+  nanosort_segmented_parallel(&ps[0], &offsets[0], count, comp, 4);
+
+  std::vector<T> es = a;
+  for (size_t i = 0; i < count; ++i)
+    std::sort(es.begin() + offsets[i], es.begin() + offsets[i + 1], comp);
+
+  assert(es == ns);
+  assert(es == ps);
+}
+
+template <typename T, typename Compare>
+struct PairFirstCompare {
+  Compare comp;
+
+  bool operator()(const std::pair<T, int>& l,
+                  const std::pair<T, int>& r) const {
+    return comp(l.first, r.first);
+  }
+};
+
+// Merges runs of a with given sizes; elements of a are sorted by first and
+// second stores the original position to check stability
+template <typename T, typename Compare>
+void test_merge_k(std::vector<std::pair<T, int> > a,
+                  const std::vector<size_t>& sizes, Compare comp) {
+  typedef typename std::vector<std::pair<T, int> >::iterator It;
+
+  PairFirstCompare<T, Compare> pcomp = {comp};
+
+  std::vector<It> first, last;
+  size_t offset = 0;
+
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    first.push_back(a.begin() + offset);
+    last.push_back(a.begin() + offset + sizes[i]);
+    std::sort(first.back(), last.back(), pcomp);
+    offset += sizes[i];
+  }
+
+  for (size_t i = 0; i < a.size(); ++i) a[i].second = int(i);
+
+  std::vector<std::pair<T, int> > ms(a.size());
+  nanosort_merge_k(first.data(), last.data(), sizes.size(), ms.begin(), pcomp);
+
+  std::vector<std::pair<T, int> > es = a;
+  std::stable_sort(es.begin(), es.end(), pcomp);
+
+  assert(es == ms);
+}
+
+// Default comparator sorts floating point pointers in IEEE 754 totalOrder
+template <typename T>
+void test_total_order() {
+  T a[] = {T(1), T(0), -T(NAN), -T(INFINITY), T(NAN), -T(0), T(INFINITY)};
+  T e[] = {-T(NAN), -T(INFINITY), -T(0), T(0), T(1), T(INFINITY), T(NAN)};
+  const size_t n = sizeof(a) / sizeof(a[0]);
+
+  nanosort(a, a + n);
+  assert(memcmp(a, e, sizeof(a)) == 0);
+}
+
+struct RadixKey {
+  unsigned int operator()(const std::pair<unsigned int, int>& p) const {
+    return p.first;
+  }
+};
+
+#if __cplusplus >= 202002L || (defined(_MSVC_LANG) && _MSVC_LANG >= 202002L)
+// Sorts a permutation of 0..N-1 at compile time
+template <typename T, size_t N, typename Sort>
+constexpr bool sort_constexpr(Sort sort) {
+  std::array<T, N> a = {};
+  for (size_t i = 0; i < N; ++i) a[i] = T(i * 37 % N);
+
+  sort(a);
+
+  for (size_t i = 0; i < N; ++i)
+    if (a[i] != T(i)) return false;
+
+  return true;
+}
+
+static_assert(sort_constexpr<int, 200>(
+    [](auto& a) { nanosort(a.begin(), a.end()); }));
+static_assert(sort_constexpr<float, 100>(
+    [](auto& a) { nanosort(a.data(), a.data() + a.size()); }));
+static_assert(sort_constexpr<double, 100>([](auto& a) {
+  nanosort(a.begin(), a.end(), std::less<double>());
+}));
+static_assert(sort_constexpr<unsigned int, 300>([](auto& a) {
+  nanosort_detail::heap_sort(a.begin(), a.end(), std::less<unsigned int>());
+}));
+static_assert(sort_constexpr<int, 16>(
+    [](auto& a) { nanosort_fixed<16>(a.begin()); }));
+#endif
+
 int main() {
   const size_t N = 1000;
 
@@ -84,4 +487,514 @@ int main() {
     std::vector<unsigned int> A;
     test_sort(A);
   }
+
+  // Strings are not trivial so they use the block partition
+  {
+    std::vector<std::string> A(N);
+    for (size_t i = 0; i < N; ++i) A[i] = std::to_string(i * 123456789);
+    test_sort(A);
+    test_sort(A, std::greater<std::string>());
+  }
+
+  {
+    std::vector<std::string> A(N);
+    for (size_t i = 0; i < N; ++i) A[i] = std::to_string(i % 7 ? 0 : i);
+    test_sort(A);
+    test_sort(A, std::greater<std::string>());
+  }
+
+  {
+    std::vector<std::string> A(N);
+    for (size_t i = 0; i < N; ++i) A[i] = std::to_string(N - i);
+    test_sort(A);
+  }
+
+  {
+    std::vector<unsigned int> A(N * 300);
+    for (size_t i = 0; i < A.size(); ++i) A[i] = unsigned(i * 123456789);
+    test_parallel(A);
+    test_parallel(A, std::greater<unsigned int>());
+  }
+
+  {
+    std::vector<int> A(N * 300);
+    for (size_t i = 0; i < A.size(); ++i) A[i] = i % 7 == 0 ? int(i) : 0;
+    test_parallel(A);
+  }
+
+  {
+    std::vector<int> A(N * 10);
+    for (size_t i = 0; i < A.size(); ++i) A[i] = int(i / 3);
+    test_adaptive(A);
+    test_adaptive(A, std::greater<int>());
+
+    // Appended records
+    for (size_t i = 0; i < 100; ++i) A[A.size() - 1 - i] = int(i * 12345) % N;
+    test_adaptive(A);
+
+    // Few inversions
+    for (size_t i = 0; i < A.size(); ++i) A[i] = int(i);
+    for (size_t i = 0; i < 100; ++i) std::swap(A[i * 97], A[i * 97 + 5]);
+    test_adaptive(A);
+
+    for (size_t i = 0; i < A.size(); ++i) A[i] = int(i * 123456789);
+    test_adaptive(A);
+
+    for (size_t i = 0; i < A.size(); ++i) A[i] = 0;
+    test_adaptive(A);
+  }
+
+  {
+    std::vector<int> A(N * 10);
+    for (size_t i = 0; i < A.size(); ++i) A[i] = int(i * 123456789) % 1000;
+    test_unique(A);
+    test_unique(A, std::greater<int>());
+
+    for (size_t i = 0; i < A.size(); ++i) A[i] = int(i * 123456789);
+    test_unique(A);
+
+    for (size_t i = 0; i < A.size(); ++i) A[i] = int(i % 16);
+    test_unique(A);
+
+    for (size_t i = 0; i < A.size(); ++i) A[i] = i % 7 == 0 ? int(i) : 0;
+    test_unique(A);
+
+    for (size_t i = 0; i < A.size(); ++i) A[i] = 0;
+    test_unique(A);
+
+    A.resize(10);
+    test_unique(A);
+
+    A.clear();
+    test_unique(A);
+  }
+
+  {
+    std::vector<std::string> A(N);
+    for (size_t i = 0; i < A.size(); ++i)
+      A[i] = std::to_string(int(i * 123456789) % 100);
+    test_unique(A);
+  }
+
+  {
+    std::vector<int> A(N * 10);
+    for (size_t i = 0; i < A.size(); ++i) A[i] = int(i * 123456789);
+    test_select(A);
+    test_select(A, std::greater<int>());
+
+    for (size_t i = 0; i < A.size(); ++i) A[i] = int(i % 16);
+    test_select(A);
+
+    for (size_t i = 0; i < A.size(); ++i) A[i] = int(i);
+    test_select(A);
+  }
+
+  {
+    std::vector<std::string> A(N);
+    for (size_t i = 0; i < A.size(); ++i)
+      A[i] = std::to_string(int(i * 123456789) % 1000);
+    test_select(A);
+  }
+
+  for (size_t n = 0; n <= 100; ++n) {
+    std::vector<std::pair<int, int> > A(n);
+    for (size_t i = 0; i < n; ++i) A[i] = std::make_pair(int(i * 7) % 5, i);
+    test_stable(A, PairFirstLess());
+  }
+
+  {
+    std::vector<std::pair<int, int> > A(N * 10);
+    for (size_t i = 0; i < A.size(); ++i)
+      A[i] = std::make_pair(int(i * 123456789) % 100, int(i));
+    test_stable(A, PairFirstLess());
+
+    for (size_t i = 0; i < A.size(); ++i) A[i].first = int(A.size() - i) / 7;
+    test_stable(A, PairFirstLess());
+  }
+
+  {
+    std::vector<std::string> A(N);
+    for (size_t i = 0; i < A.size(); ++i)
+      A[i] = std::to_string(int(i * 123456789) % 1000);
+    test_stable(A, std::less<std::string>());
+  }
+
+  {
+    std::vector<std::string> A(N);
+    for (size_t i = 0; i < A.size(); ++i) A[i] = std::to_string(i + N);
+    for (size_t i = 0; i < 10; ++i) A[A.size() - 1 - i] = std::to_string(i * 7);
+    test_adaptive(A);
+  }
+
+  {
+    std::vector<int> A(N * 10);
+    for (size_t i = 0; i < A.size(); ++i) A[i] = int(i * 123456789);
+    test_radix(A);
+  }
+
+  {
+    std::vector<unsigned long long> A(N * 10);
+    for (size_t i = 0; i < A.size(); ++i) A[i] = i * 12345678987654321ull;
+    test_radix(A);
+  }
+
+  {
+    std::vector<unsigned int> A(N * 50);
+    for (size_t i = 0; i < A.size(); ++i)
+      A[i] = unsigned(i * 123456789) % (i % 3 ? 1000 : 4);
+
+    test_fixed<1>(A);
+    test_fixed<2>(A);
+    test_fixed<3>(A);
+    test_fixed<4>(A);
+    test_fixed<5>(A, std::greater<unsigned int>());
+    test_fixed<7>(A);
+    test_fixed<8>(A);
+    test_fixed<16>(A);
+    test_fixed<17>(A);
+    test_fixed<32>(A, std::greater<unsigned int>());
+
+    std::vector<double> Ad(A.begin(), A.end());
+    test_fixed<4>(Ad);
+    test_fixed<13>(Ad);
+
+    std::vector<std::string> As(A.size());
+    for (size_t i = 0; i < A.size(); ++i) As[i] = std::to_string(A[i]);
+
+    test_fixed<3>(As);
+    test_fixed<9>(As);
+    test_fixed<31>(As);
+  }
+
+  {
+    std::vector<float> A(N * 10);
+    for (size_t i = 0; i < A.size(); ++i) A[i] = float(int(i * 12345) % 1000);
+    test_radix(A);
+  }
+
+  {
+    std::vector<std::pair<unsigned int, int> > A(N * 10);
+    for (size_t i = 0; i < A.size(); ++i)
+      A[i] = std::make_pair(unsigned(i * 123456789) >> 12, int(i));
+
+    nanosort_radix(A.begin(), A.end(), RadixKey());
+
+    for (size_t i = 1; i < A.size(); ++i) assert(A[i - 1].first <= A[i].first);
+  }
+
+  {
+    std::vector<std::pair<unsigned int, int> > A(N * 10);
+    for (size_t i = 0; i < A.size(); ++i)
+      A[i] = std::make_pair(unsigned(i * 123456789) % 1000, int(i));
+
+    test_by_key(A, RadixKey(), std::less<unsigned int>());
+    test_by_key(A, RadixKey(), std::greater<unsigned int>());
+  }
+
+  {
+    std::vector<std::string> A(N);
+    for (size_t i = 0; i < A.size(); ++i)
+      A[i] = std::to_string(int(i * 123456789) % 100000);
+
+    test_by_key(
+        A, [](const std::string& s) { return s.size(); }, std::less<size_t>());
+    test_by_key(
+        A, [](const std::string& s) -> const std::string& { return s; },
+        std::greater<std::string>());
+  }
+
+  {
+    std::vector<int> A(N * 10);
+    for (size_t i = 0; i < A.size(); ++i) A[i] = int(i * 123456789) % 1000;
+    test_indices<int, unsigned int>(A, std::less<int>());
+    test_indices<int, size_t>(A, std::greater<int>());
+  }
+
+  {
+    std::vector<std::string> A(N);
+    for (size_t i = 0; i < A.size(); ++i)
+      A[i] = std::to_string(int(i * 123456789) % 100000);
+
+    test_indices<std::string, unsigned int>(A, std::less<std::string>());
+  }
+
+  {
+    // Rows are larger than 16 bytes so large arrays use dual-pivot partition
+    std::vector<int> A(N * 30);
+    for (size_t i = 0; i < A.size(); ++i) A[i] = int(i * 123456789) % 1000;
+    test_soa(A);
+
+    A.resize(N * 10);
+    test_soa(A);
+
+    A.resize(10);
+    test_soa(A);
+
+    A.clear();
+    test_soa(A);
+  }
+
+  {
+    std::vector<std::string> A(N);
+    for (size_t i = 0; i < A.size(); ++i)
+      A[i] = std::to_string(int(i * 123456789) % 100000);
+    test_soa(A);
+  }
+
+  {
+    std::vector<std::string> A(N * 10);
+    for (size_t i = 0; i < A.size(); ++i)
+      A[i] = std::to_string(int(i * 123456789) % 10000);
+    test_strings(A);
+
+    // Long common prefixes take several chunks or are compared directly
+    for (size_t i = 0; i < A.size(); ++i)
+      A[i] = std::string(i % 3 * 30, 'x') + std::to_string(i * 123456789);
+    test_strings(A);
+
+    // Zero bytes and bytes above 127 in strings of all lengths below 20
+    for (size_t i = 0; i < A.size(); ++i) {
+      A[i].clear();
+      for (size_t k = 0; k < i % 20; ++k) A[i] += char((i * 7 >> k) % 3 * 100);
+    }
+    test_strings(A);
+
+    A.resize(10);
+    test_strings(A);
+
+    A.clear();
+    test_strings(A);
+  }
+
+  {
+    std::vector<int> A(N * 10);
+    for (size_t i = 0; i < A.size(); ++i) A[i] = int(i * 123456789) % 1000;
+    test_simd(A);
+    test_simd(std::vector<unsigned int>(A.begin(), A.end()));
+    test_simd(std::vector<long long>(A.begin(), A.end()));
+    test_simd(std::vector<unsigned long long>(A.begin(), A.end()));
+    test_simd(std::vector<float>(A.begin(), A.end()));
+    test_simd(std::vector<double>(A.begin(), A.end()));
+
+    // Mostly zeros make partitions skewed, which separates elements equal to
+    // pivot; unsigned values above INT_MAX need biased comparisons
+    for (size_t i = 0; i < A.size(); ++i) A[i] = i % 7 == 0 ? -1 : 0;
+    test_simd(std::vector<unsigned int>(A.begin(), A.end()));
+    test_simd(std::vector<unsigned long long>(A.begin(), A.end()));
+  }
+
+  for (size_t n = 1; n <= 16; ++n) {
+    std::vector<long long> A(n);
+    for (size_t i = 0; i < n; ++i) A[i] = (long long)(i * 123456789) % 7 - 3;
+    A[0] = n % 2 ? 0x7fffffffffffffffll : -0x7fffffffffffffffll - 1;
+    test_simd(std::vector<int>(A.begin(), A.end()));
+    test_simd(std::vector<unsigned int>(A.begin(), A.end()));
+    test_simd(A);
+    test_simd(std::vector<unsigned long long>(A.begin(), A.end()));
+    test_simd(std::vector<float>(A.begin(), A.end()));
+    test_simd(std::vector<double>(A.begin(), A.end()));
+  }
+
+  for (size_t n = 1; n <= 16; ++n) {
+    std::vector<float> A(n);
+    for (size_t i = 0; i < n; ++i) A[i] = i % 3 == 1 ? -0.f : 0.f;
+
+    std::vector<float> ns = A;
+    nanosort(&ns[0], &ns[0] + ns.size());
+
+    // -0 and +0 are equivalent, but sorting must not change the sign bits
+    size_t an = 0, nn = 0;
+    for (size_t i = 0; i < n; ++i) an += signbit(A[i]) != 0;
+    for (size_t i = 0; i < n; ++i) nn += signbit(ns[i]) != 0;
+    assert(an == nn);
+  }
+
+  {
+    std::vector<int> A(N * 10);
+    for (size_t i = 0; i < A.size(); ++i) A[i] = int(i * 123456789) % 1000;
+
+    nanosort_stats stats = {};
+    std::vector<int> ns = A;
+    nanosort_instrumented(ns.begin(), ns.end(), stats);
+
+    std::vector<int> es = A;
+    std::sort(es.begin(), es.end());
+    assert(es == ns);
+
+    // Every element ends up in exactly one leaf or is used as a pivot
+    size_t leaves = 0;
+    for (size_t i = 0; i < 16; ++i) leaves += stats.small_sorts[i] * i;
+
+    assert(stats.comparisons > A.size() * 10);
+    assert(stats.partitions > 0 && stats.partition_elements > A.size());
+    assert(stats.moves >= stats.partition_elements * 2);
+    assert(leaves > 0 && leaves <= A.size());
+    assert(stats.max_depth > 10 && stats.max_depth < 50);
+    assert(stats.heap_sorts == 0);
+
+    // Equal elements are handled by a single skewed partition
+    stats = nanosort_stats();
+    std::vector<int> eq(N * 10, 42);
+    nanosort_instrumented(eq.begin(), eq.end(), std::less<int>(), stats);
+    assert(stats.partitions == 1 && stats.skewed_partitions == 1);
+    assert(stats.max_depth == 1);
+
+    // Both passes of the skewed partition swap every element
+    assert(stats.moves == eq.size() * 4);
+
+    // Block partition only moves misplaced elements, so sorted strings are
+    // mostly moved by small sorts
+    stats = nanosort_stats();
+    std::vector<std::string> ss(N * 10);
+    for (size_t i = 0; i < ss.size(); ++i) ss[i] = std::to_string(i);
+    std::sort(ss.begin(), ss.end());
+    nanosort_instrumented(ss.begin(), ss.end(), stats);
+    assert(stats.moves > 0 && stats.moves < stats.partition_elements);
+
+    // Recursion limit of zero results in heap sort fallback
+    stats = nanosort_stats();
+    nanosort_detail::StatsRecorder recorder = {&stats, 0};
+    nanosort_detail::sort<int>(ns.begin(), ns.end(), 0, std::less<int>(),
+                               recorder);
+    assert(stats.heap_sorts == 1 && stats.heap_sort_elements == ns.size());
+  }
+
+  // Arrays that are large enough for samplesort to use several buckets
+  {
+    std::vector<unsigned int> A(N * 1000);
+    for (size_t i = 0; i < A.size(); ++i) A[i] = unsigned(i * 123456789);
+    test_samplesort(A);
+    test_samplesort(A, std::greater<unsigned int>());
+
+    // Few unique values result in equal splitters and equality buckets
+    for (size_t i = 0; i < A.size(); ++i) A[i] = unsigned(i * 123456789) % 7;
+    test_samplesort(A);
+
+    for (size_t i = 0; i < A.size(); ++i) A[i] = 0;
+    test_samplesort(A);
+
+    std::vector<double> Ad(N * 300 + 5);
+    for (size_t i = 0; i < Ad.size(); ++i) Ad[i] = double(Ad.size() - i);
+    test_samplesort(Ad);
+
+    std::vector<std::string> As(N * 100);
+    for (size_t i = 0; i < As.size(); ++i)
+      As[i] = std::to_string(int(i * 123456789) % 100000);
+    test_samplesort(As);
+  }
+
+  // Large elements in arrays that don't fit in cache use three-way partition
+  {
+    typedef std::array<unsigned int, 8> Record;
+
+    std::vector<Record> A(N * 50);
+    for (size_t i = 0; i < A.size(); ++i)
+      A[i] = Record{{unsigned(i * 123456789) % 100000, 0, 0, 0, 0, 0, 0,
+                     unsigned(i)}};
+
+    std::vector<Record> es = A;
+    std::sort(es.begin(), es.end());
+
+    std::vector<Record> ns = A;
+    nanosort(ns.begin(), ns.end());
+    assert(es == ns);
+
+    nanosort(ns.begin(), ns.end(), std::greater<Record>());
+    assert(std::equal(es.rbegin(), es.rend(), ns.begin()));
+
+    // Two distinct values make both pivots equal to them, so the middle part
+    // has all elements and needs a regular partition to make progress
+    for (size_t i = 0; i < A.size(); ++i) A[i] = Record{{unsigned(i % 2)}};
+
+    nanosort_stats stats = {};
+    ns = A;
+    nanosort_instrumented(ns.begin(), ns.end(), stats);
+    assert(std::is_sorted(ns.begin(), ns.end()));
+    assert(stats.heap_sorts == 0 && stats.max_depth < 10);
+  }
+
+  for (size_t k = 0; k <= 40; k += k < 10 ? 1 : 10) {
+    std::vector<size_t> sizes(k);
+    for (size_t i = 0; i < k; ++i) sizes[i] = (i * 123456789) % 7 * 37 % 100;
+
+    std::vector<std::pair<int, int> > A;
+    for (size_t i = 0; i < k; ++i)
+      for (size_t j = 0; j < sizes[i]; ++j)
+        A.push_back(std::make_pair(int(A.size() * 123456789) % 50, 0));
+
+    test_merge_k(A, sizes, std::less<int>());
+    test_merge_k(A, sizes, std::greater<int>());
+
+    std::vector<std::pair<std::string, int> > As;
+    for (size_t i = 0; i < A.size(); ++i)
+      As.push_back(std::make_pair(std::to_string(A[i].first), 0));
+
+    test_merge_k(As, sizes, std::less<std::string>());
+  }
+
+  {
+    // Segments of varying sizes including empty ones, and one large segment
+    // that is sorted using multiple threads
+    std::vector<size_t> offsets(1);
+    for (size_t i = 0; i < 2000; ++i) {
+      size_t size = (i * 123456789) % 97 % (i % 3 ? 8 : 97);
+      offsets.push_back(offsets.back() + size);
+    }
+    offsets.push_back(offsets.back() + N * 300);
+    for (size_t i = 0; i < 100; ++i) offsets.push_back(offsets.back() + i);
+
+    std::vector<int> A(offsets.back());
+    for (size_t i = 0; i < A.size(); ++i) A[i] = int(i * 123456789) % 1000;
+
+    test_segmented(A, offsets, std::less<int>());
+    test_segmented(A, offsets, std::greater<int>());
+    test_segmented(std::vector<double>(A.begin(), A.end()), offsets,
+                   std::less<double>());
+
+    std::vector<std::string> As(offsets[2000]);
+    for (size_t i = 0; i < As.size(); ++i) As[i] = std::to_string(A[i]);
+
+    offsets.resize(2001);
+    test_segmented(As, offsets, std::less<std::string>());
+  }
+
+  {
+    std::vector<float> A(N * 10);
+    for (size_t i = 0; i < A.size(); ++i)
+      A[i] = i % 5 == 0 ? NAN : float(int(i * 123456789) % 1000);
+
+    std::vector<float> ns = A;
+    nanosort(&ns[0], &ns[0] + ns.size());
+
+    std::vector<float> ss = A, scratch(A.size());
+    nanosort_stable(ss.begin(), ss.end(), scratch.begin());
+
+    // NaN breaks strict weak ordering but the result must be a permutation
+    std::vector<unsigned int> ab(A.size()), nb(A.size()), sb(A.size());
+    memcpy(&ab[0], &A[0], A.size() * sizeof(float));
+    memcpy(&nb[0], &ns[0], ns.size() * sizeof(float));
+    memcpy(&sb[0], &ss[0], ss.size() * sizeof(float));
+    std::sort(ab.begin(), ab.end());
+    std::sort(nb.begin(), nb.end());
+    std::sort(sb.begin(), sb.end());
+    assert(ab == nb);
+    assert(ab == sb);
+  }
+
+  {
+    std::vector<float> A(N * 10);
+    for (size_t i = 0; i < A.size(); ++i)
+      A[i] = i % 5 == 0 ? NAN : float(int(i * 123456789) % 1000);
+
+    std::vector<float> ns = A;
+    nanosort(&ns[0], &ns[0] + ns.size());
+
+    // Positive NaNs go last, after all other values in sorted order
+    size_t k = ns.size() - (A.size() + 4) / 5;
+    for (size_t i = 0; i < ns.size(); ++i) assert(isnan(ns[i]) == (i >= k));
+    for (size_t i = 1; i < k; ++i) assert(ns[i - 1] <= ns[i]);
+
+    test_total_order<float>();
+    test_total_order<double>();
+  }
 }